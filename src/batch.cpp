@@ -0,0 +1,383 @@
+#include "batch.h"
+#include "ppm.h"
+#include "filter.h"
+#include "bilateral.h"
+#include "tonemap.h"
+#include "threadpool.h"
+#include "framebuffer.h"
+#include "stream.h"
+#include "fused.h"
+#include "profile.h"
+#include "imagecache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BATCH_DIRS 1
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+//one image moving through the pipeline; slots are recycled so memory stays bounded
+struct batchImage {
+  std::string input;
+  std::string output;
+  //set when the input couldn't be decoded; the slot passes through the pipeline without output
+  bool failed;
+  planarImage source;
+  std::vector<unsigned char> pixels;
+  //tone mapped result for 16 bit and float outputs, which skip the 8 bit pack
+  planarImage toned;
+};
+
+//blocking queue handing slots between the pipeline stages
+class slotQueue {
+  private:
+    std::deque<batchImage*> items;
+    std::mutex lock;
+    std::condition_variable ready;
+  public:
+    void push(batchImage* item){
+      {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->items.push_back(item);
+      }
+      this->ready.notify_one();
+    }
+    batchImage* pop(){
+      std::unique_lock<std::mutex> guard(this->lock);
+      while(this->items.empty()){
+        this->ready.wait(guard);
+      }
+      batchImage* item = this->items.front();
+      this->items.pop_front();
+      return item;
+    }
+};
+
+//file name without its directory or extension
+static std::string baseName(const std::string& path){
+  size_t slash = path.find_last_of("/\\");
+  std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+  size_t dot = name.find_last_of('.');
+  return (dot == std::string::npos || dot == 0) ? name : name.substr(0, dot);
+}
+
+static bool isImageName(const std::string& name){
+  size_t dot = name.find_last_of('.');
+  if(dot == std::string::npos) return false;
+  std::string ext = name.substr(dot + 1);
+  return ext == "ppm" || ext == "pfm" || ext == "hdr" || ext == "pic";
+}
+
+//expands directories into the images they contain, in name order
+static void collectInputs(const std::string& path, std::vector<std::string>& inputs){
+#ifdef BATCH_DIRS
+  struct stat info;
+  if(stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode)){
+    std::vector<std::string> names;
+    DIR* dir = opendir(path.c_str());
+    if(dir == NULL) return;
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL){
+      if(isImageName(entry->d_name)) names.push_back(path + "/" + entry->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    inputs.insert(inputs.end(), names.begin(), names.end());
+    return;
+  }
+#endif
+  inputs.push_back(path);
+}
+
+//decodes an image into the slot's planar source (in the same 0-255 units the viewer uses)
+static void loadImage(batchImage* image){
+  static profileStage* stage = profileStageFor("batch::load");
+  scopedTimer timer(stage);
+  image->failed = !decodeImage(image->input, image->source);
+  if(image->failed) return;
+  timer.setPixels((long long)image->source.returnWidth() * image->source.returnHeight());
+}
+
+//writes whatever -profile and -trace asked for
+static void finishProfile(const std::string& profileName, const std::string& traceName){
+  if(!profileName.empty()) writeProfile(profileName);
+  if(!traceName.empty()) writeTrace(traceName);
+}
+
+//kernel for a -kernel name, or -1 if it isn't one
+static int kernelType(const char* name){
+  if(strcmp(name, "box") == 0) return KERNEL_BOX;
+  if(strcmp(name, "gaussian") == 0) return KERNEL_GAUSSIAN;
+  if(strcmp(name, "sharpen") == 0) return KERNEL_SHARPEN;
+  if(strcmp(name, "bilateral") == 0) return KERNEL_BILATERAL;
+  if(strcmp(name, "none") == 0) return KERNEL_NONE;
+  return -1;
+}
+
+//operator for a -tone name, or -1 if it isn't one
+static int toneOperator(const char* name){
+  if(strcmp(name, "power") == 0) return TONE_POWER;
+  if(strcmp(name, "reinhard") == 0) return TONE_REINHARD;
+  if(strcmp(name, "filmic") == 0) return TONE_FILMIC;
+  if(strcmp(name, "local") == 0) return TONE_LOCAL;
+  return -1;
+}
+
+//layout and maxVal for a -format name; false if it isn't one
+static bool outputFormat(const char* name, int& format, int& maxVal){
+  maxVal = 255;
+  if(strcmp(name, "ppm") == 0) format = PPM_BINARY;
+  else if(strcmp(name, "p3") == 0) format = PPM_ASCII;
+  else if(strcmp(name, "pfm") == 0) format = PPM_FLOAT;
+  else if(strcmp(name, "ppm16") == 0){
+    format = PPM_BINARY;
+    maxVal = 65535;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+//writes a tone mapped planar image (0-255) without quantizing it to 8 bits first; false if the file couldn't be written
+static bool writeToned(const planarImage& toned, ppm& file, const std::string& name){
+  int width = toned.returnWidth(), height = toned.returnHeight();
+  std::vector<float> row(3 * width);
+  file.beginWrite(name, width, height);
+  for(int y = 0; y < height; y++){
+    const float* red = toned.returnRow(0, y);
+    const float* green = toned.returnRow(1, y);
+    const float* blue = toned.returnRow(2, y);
+    for(int x = 0; x < width; x++){
+      row[3 * x] = red[x] * (1.0f / 255.0f);
+      row[3 * x + 1] = green[x] * (1.0f / 255.0f);
+      row[3 * x + 2] = blue[x] * (1.0f / 255.0f);
+    }
+    file.writeScanline(&row[0]);
+  }
+  return file.endWrite();
+}
+
+int runBatch(int argc, char** argv){
+  float gamma = 1.0, gain = 1.0, bias = 1.0;
+  int radius = 1, type = KERNEL_NONE, inflight = 3, format = PPM_BINARY, maxVal = 255, op = TONE_POWER;
+  bool stream = false, exposure = false;
+  std::string profileName, traceName;
+  std::vector<std::string> inputs;
+  if(argc < 2){
+    std::cout << "usage: prog02 -batch outdir [-gamma g] [-gain g] [-bias b] [-radius r] [-kernel box|gaussian|sharpen|bilateral|none] [-exact] [-format ppm|ppm16|pfm|p3] [-tone power|reinhard|filmic|local] [-auto] [-t threads] [-j inflight] [-stream] [-profile summary.json] [-trace trace.json] inputs..." << std::endl;
+    return 1;
+  }
+  std::string outdir = argv[0];
+  for(int i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-gamma") == 0 && i + 1 < argc) gamma = (float)atof(argv[++i]);
+    else if(strcmp(argv[i], "-gain") == 0 && i + 1 < argc) gain = (float)atof(argv[++i]);
+    else if(strcmp(argv[i], "-bias") == 0 && i + 1 < argc) bias = (float)atof(argv[++i]);
+    else if(strcmp(argv[i], "-radius") == 0 && i + 1 < argc) radius = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-kernel") == 0 && i + 1 < argc){
+      type = kernelType(argv[++i]);
+      if(type == -1){
+        std::cout << "Unknown kernel " << argv[i] << std::endl;
+        return 1;
+      }
+    }
+    else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc) setPoolThreads(atoi(argv[++i]));
+    else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc) inflight = std::max(2, atoi(argv[++i]));
+    else if(strcmp(argv[i], "-stream") == 0) stream = true;
+    else if(strcmp(argv[i], "-exact") == 0) setBilateralPath(BILATERAL_EXACT);
+    else if(strcmp(argv[i], "-format") == 0 && i + 1 < argc){
+      if(!outputFormat(argv[++i], format, maxVal)){
+        std::cout << "Unknown output format " << argv[i] << std::endl;
+        return 1;
+      }
+    }
+    else if(strcmp(argv[i], "-tone") == 0 && i + 1 < argc){
+      op = toneOperator(argv[++i]);
+      if(op < 0){
+        std::cout << "Unknown tone operator " << argv[i] << std::endl;
+        return 1;
+      }
+    }
+    else if(strcmp(argv[i], "-auto") == 0) exposure = true;
+    else if(strcmp(argv[i], "-profile") == 0 && i + 1 < argc) profileName = argv[++i];
+    else if(strcmp(argv[i], "-trace") == 0 && i + 1 < argc) traceName = argv[++i];
+    else if(argv[i][0] == '-'){
+      std::cout << "Unknown option " << argv[i] << " (or it is missing its value)" << std::endl;
+      return 1;
+    }
+    else collectInputs(argv[i], inputs);
+  }
+  if(inputs.empty()){
+    std::cout << "No input images" << std::endl;
+    return 1;
+  }
+  setProfiling(!profileName.empty() || !traceName.empty(), !traceName.empty());
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  //only 8 bit outputs skip the float tone mapped copy
+  bool deep = format == PPM_FLOAT || maxVal > 255;
+  std::string extension = format == PPM_FLOAT ? ".pfm" : ".ppm";
+#ifdef BATCH_DIRS
+  struct stat info;
+  if(stat(outdir.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)){
+    std::cout << "Output directory " << outdir << " doesn't exist" << std::endl;
+    return 1;
+  }
+#endif
+  //inputs that differ only in directory or extension (a.ppm, a.hdr) would overwrite each other's output
+  std::vector<std::string> outputs(inputs.size());
+  std::map<std::string, size_t> writers;
+  for(size_t i = 0; i < inputs.size(); i++){
+    outputs[i] = outdir + "/" + baseName(inputs[i]) + extension;
+    std::map<std::string, size_t>::iterator other = writers.find(outputs[i]);
+    if(other != writers.end()){
+      std::cout << inputs[other->second] << " and " << inputs[i] << " would both be written to " << outputs[i] << std::endl;
+      return 1;
+    }
+    writers[outputs[i]] = i;
+  }
+
+  //scanline at a time, one image after another; only a window of rows is ever in memory
+  if(stream){
+    if(type == KERNEL_BILATERAL){
+      std::cout << "The bilateral filter needs the whole image and can't be used with -stream" << std::endl;
+      return 1;
+    }
+    if(deep){
+      std::cout << "-stream only writes 8 bit outputs (ppm or p3)" << std::endl;
+      return 1;
+    }
+    if(op == TONE_LOCAL || exposure){
+      std::cout << "The local operator and -auto need the whole image and can't be used with -stream" << std::endl;
+      return 1;
+    }
+    size_t failures = 0, unwritten = 0;
+    for(size_t i = 0; i < inputs.size(); i++){
+      int result = streamImage(inputs[i], outputs[i], gamma, gain, bias, radius, type, format, op);
+      if(result == STREAM_WRITTEN){
+        std::cout << inputs[i] << " -> " << outputs[i] << "\n";
+      } else if(result == STREAM_UNREADABLE){
+        std::cout << inputs[i] << " skipped\n";
+        failures++;
+      } else {
+        std::cout << inputs[i] << " -> " << outputs[i] << " failed: couldn't write it\n";
+        unwritten++;
+      }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << inputs.size() << " images in " << seconds << "s (" << inputs.size() / seconds << " images/sec)";
+    if(failures > 0) std::cout << ", " << failures << " couldn't be decoded";
+    if(unwritten > 0) std::cout << ", " << unwritten << " couldn't be written";
+    std::cout << std::endl;
+    finishProfile(profileName, traceName);
+    return failures + unwritten > 0 ? 1 : 0;
+  }
+
+  //every slot starts out free; the reader blocks once all of them are in use
+  std::vector<batchImage> slots(inflight);
+  slotQueue freeSlots, loaded, finished;
+  for(int i = 0; i < inflight; i++){
+    freeSlots.push(&slots[i]);
+  }
+
+  std::thread reader([&](){
+    for(size_t i = 0; i < inputs.size(); i++){
+      batchImage* image = freeSlots.pop();
+      image->input = inputs[i];
+      image->output = outputs[i];
+      loadImage(image);
+      loaded.push(image);
+    }
+  });
+
+  //written by the writer thread only, read after it is joined
+  size_t failures = 0, unwritten = 0;
+  std::thread writer([&](){
+    for(size_t i = 0; i < inputs.size(); i++){
+      batchImage* image = finished.pop();
+      if(image->failed){
+        std::cout << image->input << " skipped\n";
+        failures++;
+        freeSlots.push(image);
+        continue;
+      }
+      ppm file;
+      file.setFormat(format, maxVal);
+      bool written;
+      if(deep){
+        written = writeToned(image->toned, file, image->output);
+      } else {
+        file.setWidth(image->source.returnWidth());
+        file.setHeight(image->source.returnHeight());
+        file.setData(&image->pixels[0]);
+        written = file.writeData(image->output);
+      }
+      if(written){
+        std::cout << image->input << " -> " << image->output << "\n";
+      } else {
+        std::cout << image->input << " -> " << image->output << " failed: couldn't write it\n";
+        unwritten++;
+      }
+      freeSlots.push(image);
+    }
+  });
+
+  //filtering runs here, spread over the shared pool
+  frameBuffers buffers;
+  for(size_t i = 0; i < inputs.size(); i++){
+    batchImage* image = loaded.pop();
+    if(image->failed){
+      finished.push(image);
+      continue;
+    }
+    int width = image->source.returnWidth(), height = image->source.returnHeight();
+    //8 bit outputs of small kernels are convolved, tone mapped and packed in one pass
+    if(!deep && !exposure && fusedSupported(radius, type, op)){
+      image->pixels.resize(3 * width * height);
+      convolveToneMapRGB24(image->source, &image->pixels[0], radius, type, gamma, gain, bias, op);
+      finished.push(image);
+      continue;
+    }
+    const planarImage* toned = &image->source;
+    if(type != KERNEL_NONE){
+      buffers.resize(width, height);
+      convolution(image->source, *buffers.returnFiltered(), radius, type, buffers.returnScratch());
+      toned = buffers.returnFiltered();
+    }
+    //-auto replaces gain and bias with values measured from this image
+    float imageGain = gain, imageBias = bias;
+    if(exposure){
+      toneStats stats;
+      measureTone(*toned, stats);
+      autoExposure(stats, op, gamma, imageGain, imageBias);
+    }
+    if(deep){
+      toneMap(*toned, image->toned, gamma, imageGain, imageBias, op);
+    } else {
+      image->pixels.resize(3 * width * height);
+      toneMapRGB24(*toned, &image->pixels[0], gamma, imageGain, imageBias, op);
+    }
+    finished.push(image);
+  }
+  reader.join();
+  writer.join();
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << inputs.size() << " images in " << seconds << "s (" << inputs.size() / seconds << " images/sec)";
+  if(failures > 0) std::cout << ", " << failures << " couldn't be decoded";
+  if(unwritten > 0) std::cout << ", " << unwritten << " couldn't be written";
+  std::cout << std::endl;
+  finishProfile(profileName, traceName);
+  return failures + unwritten > 0 ? 1 : 0;
+}
@@ -0,0 +1,37 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+//
+// Headless mode: filters and tone maps a list of images (or every image in
+// the given directories) without opening a window.
+//
+//   prog02 -batch outdir [-gamma g] [-gain g] [-bias b] [-radius r]
+//          [-kernel box|gaussian|sharpen|bilateral|none] [-exact]
+//          [-format ppm|ppm16|pfm|p3] [-tone power|reinhard|filmic|local]
+//          [-auto] [-t threads] [-j inflight] [-stream]
+//          [-profile summary.json] [-trace trace.json] inputs...
+//
+// Reading, filtering and writing run on separate threads so consecutive
+// images overlap; at most -j images (default 3) are held in memory at once.
+// With -stream each image is instead processed a scanline at a time (see
+// streamImage), so images larger than memory can be handled; the bilateral
+// filter needs whole images, so it can't be streamed. -exact runs it through
+// the brute force reference (see bilateral.h).
+// Each result is written to outdir with the input's name, as an 8 bit ppm
+// unless -format asks for 16 bit (ppm16), PFM or ASCII (p3) output. The
+// 16 bit and PFM results are tone mapped in float and never pass through
+// 8 bits; -stream only produces the 8 bit formats.
+// -tone picks the tone operator (see tonemap.h); -auto sets gain and bias for
+// each image from its own luminance statistics (see autoExposure). Neither
+// the local operator nor -auto can be streamed.
+// 8 bit outputs of box, gaussian and sharpen kernels up to FIXED_RADIUS_MAX
+// are filtered, tone mapped and packed in one pass (see convolveToneMapRGB24).
+// -profile and -trace write the per stage timings (see profile.h) on exit.
+//
+// \param argc number of arguments after -batch
+// \param argv arguments after -batch
+// \return integer indicating success (0) or failure (nonzero)
+//
+int runBatch(int argc, char** argv);
+
+#endif
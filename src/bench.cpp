@@ -0,0 +1,329 @@
+//
+// prog02_bench: times the image kernels on synthetic images and prints one
+// record per measurement as CSV (default) or JSON.
+//
+//   prog02_bench [-json] [-sizes 640x480,1920x1080] [-radii 1-50|1,2,4]
+//                [-threads 1,2,4] [-reps n] [-conv auto|spatial|fft]
+//                [-bilateral fast|exact]
+//
+// Every timing is the best of -reps runs after one warm-up. speedup compares
+// against the same measurement on one thread, which is timed even when 1
+// isn't in -threads. The type column is the kernel
+// type for convolution and the SIMD path for toneMapRGB24 (toneMapRGB24_8bit
+// runs the same image quantized to 8 bits, through the exact table; the
+// _filmic and _local records time the other tone operators). -conv pins
+// convolution to one backend (the records are then named convolution_spatial
+// or convolution_fft) so the cost model in fft.h can be checked against both;
+// -bilateral exact does the same for the bilateral reference (type 3 records
+// are then named convolution_exact).
+// For every radius convolveToneMapRGB24 can fuse, the staged pipeline
+// (convolution then toneMapRGB24, recorded as staged) is timed against the
+// single fused pass (recorded as fused) on the same kernel.
+//
+#include "ppm.h"
+#include "hdr.h"
+#include "filter.h"
+#include "fft.h"
+#include "bilateral.h"
+#include "tonemap.h"
+#include "threadpool.h"
+#include "framebuffer.h"
+#include "fused.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct benchResult {
+  string kernel;
+  int type;
+  int radius;
+  int width;
+  int height;
+  int threads;
+  double nsPerPixel;
+  double gbPerSecond;
+  double speedup;
+};
+
+static vector<benchResult> results;
+static bool jsonOutput = false;
+static int reps = 3;
+
+//parses "1,2,8" or "1-50" (or a mix) into a list of numbers
+static vector<int> parseList(const char* text){
+  vector<int> values;
+  string s(text);
+  size_t pos = 0;
+  while(pos < s.size()){
+    size_t comma = s.find(',', pos);
+    string item = s.substr(pos, comma == string::npos ? string::npos : comma - pos);
+    size_t dash = item.find('-');
+    if(dash != string::npos){
+      for(int v = atoi(item.c_str()); v <= atoi(item.c_str() + dash + 1); v++){
+        values.push_back(v);
+      }
+    } else if(!item.empty()){
+      values.push_back(atoi(item.c_str()));
+    }
+    if(comma == string::npos) break;
+    pos = comma + 1;
+  }
+  return values;
+}
+
+//best wall time in seconds of reps runs of fn, after one warm-up
+static double timeBest(const function<void()>& fn){
+  fn();
+  double best = 1e30;
+  for(int i = 0; i < reps; i++){
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    fn();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if(seconds < best) best = seconds;
+  }
+  return best;
+}
+
+//records one measurement; bytesPerPixel is what the kernel reads plus writes
+static void record(const string& kernel, int type, int radius, int width, int height, int threads, double seconds, double bytesPerPixel, double baseline){
+  benchResult r;
+  double pixels = (double)width * height;
+  r.kernel = kernel;
+  r.type = type;
+  r.radius = radius;
+  r.width = width;
+  r.height = height;
+  r.threads = threads;
+  r.nsPerPixel = seconds * 1e9 / pixels;
+  r.gbPerSecond = pixels * bytesPerPixel / seconds / 1e9;
+  r.speedup = baseline > 0.0 ? baseline / seconds : 1.0;
+  results.push_back(r);
+  //progress goes to stderr so stdout stays machine readable
+  fprintf(stderr, "%s type %d radius %d %dx%d threads %d: %.3f ns/pixel\n", kernel.c_str(), type, radius, width, height, threads, r.nsPerPixel);
+}
+
+//runs fn once per thread count and records each against the single thread time
+static void sweepThreads(const vector<int>& threadCounts, const string& kernel, int type, int radius, int width, int height, double bytesPerPixel, const function<void()>& fn){
+  //timed first, and even when 1 isn't in the list, so every record has a real speedup
+  setPoolThreads(1);
+  double baseline = timeBest(fn);
+  for(size_t i = 0; i < threadCounts.size(); i++){
+    setPoolThreads(threadCounts[i]);
+    double seconds = threadCounts[i] == 1 ? baseline : timeBest(fn);
+    record(kernel, type, radius, width, height, threadCounts[i], seconds, bytesPerPixel, baseline);
+  }
+}
+
+static void printResults(){
+  if(jsonOutput){
+    printf("[\n");
+    for(size_t i = 0; i < results.size(); i++){
+      const benchResult& r = results[i];
+      printf("  {\"kernel\": \"%s\", \"type\": %d, \"radius\": %d, \"width\": %d, \"height\": %d, \"threads\": %d, "
+             "\"ns_per_pixel\": %.4f, \"gb_per_s\": %.4f, \"speedup\": %.3f}%s\n",
+             r.kernel.c_str(), r.type, r.radius, r.width, r.height, r.threads, r.nsPerPixel, r.gbPerSecond, r.speedup,
+             i + 1 < results.size() ? "," : "");
+    }
+    printf("]\n");
+  } else {
+    printf("kernel,type,radius,width,height,threads,ns_per_pixel,gb_per_s,speedup\n");
+    for(size_t i = 0; i < results.size(); i++){
+      const benchResult& r = results[i];
+      printf("%s,%d,%d,%d,%d,%d,%.4f,%.4f,%.3f\n", r.kernel.c_str(), r.type, r.radius, r.width, r.height, r.threads,
+             r.nsPerPixel, r.gbPerSecond, r.speedup);
+    }
+  }
+}
+
+int main(int argc, char** argv){
+  vector<int> sizes;
+  vector<int> radii = parseList("1,2,3,5,8,12,20,35,50");
+  vector<int> threadCounts;
+  string convolutionName = "convolution";
+  for(int t = 1; t <= (int)thread::hardware_concurrency(); t = t * 2){
+    threadCounts.push_back(t);
+  }
+  if(threadCounts.empty()) threadCounts.push_back(1);
+  sizes.push_back(640); sizes.push_back(480);
+  sizes.push_back(1920); sizes.push_back(1080);
+  sizes.push_back(3840); sizes.push_back(2160);
+
+  for(int i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-json") == 0) jsonOutput = true;
+    else if(strcmp(argv[i], "-radii") == 0 && i + 1 < argc) radii = parseList(argv[++i]);
+    else if(strcmp(argv[i], "-threads") == 0 && i + 1 < argc) threadCounts = parseList(argv[++i]);
+    else if(strcmp(argv[i], "-reps") == 0 && i + 1 < argc) reps = max(1, atoi(argv[++i]));
+    else if(strcmp(argv[i], "-conv") == 0 && i + 1 < argc){
+      i++;
+      if(strcmp(argv[i], "spatial") == 0) setConvolutionPath(CONVOLUTION_SPATIAL);
+      else if(strcmp(argv[i], "fft") == 0) setConvolutionPath(CONVOLUTION_FFT);
+      else setConvolutionPath(CONVOLUTION_AUTO);
+      if(convolutionPath() != CONVOLUTION_AUTO) convolutionName = string("convolution_") + argv[i];
+    }
+    else if(strcmp(argv[i], "-bilateral") == 0 && i + 1 < argc){
+      setBilateralPath(strcmp(argv[++i], "exact") == 0 ? BILATERAL_EXACT : BILATERAL_FAST);
+    }
+    else if(strcmp(argv[i], "-sizes") == 0 && i + 1 < argc){
+      //WxH pairs separated by commas
+      sizes.clear();
+      string s(argv[++i]);
+      size_t pos = 0;
+      while(pos < s.size()){
+        int w = 0, h = 0;
+        if(sscanf(s.c_str() + pos, "%dx%d", &w, &h) == 2){
+          sizes.push_back(w);
+          sizes.push_back(h);
+        }
+        size_t comma = s.find(',', pos);
+        if(comma == string::npos) break;
+        pos = comma + 1;
+      }
+    } else {
+      cout << "usage: prog02_bench [-json] [-sizes WxH,...] [-radii 1-50|1,2,4] [-threads 1,2,4] [-reps n] [-conv auto|spatial|fft] [-bilateral fast|exact]" << endl;
+      return 1;
+    }
+  }
+
+  const char* tempName = "prog02_bench_tmp.ppm";
+  for(size_t s = 0; s + 1 < sizes.size(); s = s + 2){
+    int width = sizes[s], height = sizes[s + 1];
+    int pixels = width * height;
+
+    //synthetic image: smooth gradients plus noise so no kernel sees constant data
+    frameBuffers buffers;
+    buffers.resize(width, height);
+    planarImage* source = buffers.returnSource();
+    srand(1);
+    for(int y = 0; y < height; y++){
+      for(int x = 0; x < width; x++){
+        source->returnRow(0, y)[x] = 255.0f * x / width;
+        source->returnRow(1, y)[x] = 255.0f * y / height;
+        source->returnRow(2, y)[x] = (float)(rand() % 256);
+      }
+    }
+
+    for(int type = KERNEL_BOX; type <= KERNEL_BILATERAL; type++){
+      string name = (type == KERNEL_BILATERAL && bilateralPath() == BILATERAL_EXACT) ? "convolution_exact" : convolutionName;
+      for(size_t r = 0; r < radii.size(); r++){
+        int radius = radii[r];
+        sweepThreads(threadCounts, name, type, radius, width, height, 24.0, [&](){
+          convolution(*source, *buffers.returnFiltered(), radius, type, buffers.returnScratch());
+        });
+      }
+    }
+
+    //the whole viewer pipeline either way; staged also writes and rereads the filtered image (and the horizontal pass's)
+    for(int type = KERNEL_BOX; type <= KERNEL_SHARPEN; type++){
+      for(size_t r = 0; r < radii.size(); r++){
+        int radius = radii[r];
+        if(!fusedSupported(radius, type, TONE_POWER)) continue;
+        sweepThreads(threadCounts, "staged", type, radius, width, height, isSeparable(type) ? 63.0 : 39.0, [&](){
+          convolution(*source, *buffers.returnFiltered(), radius, type, buffers.returnScratch());
+          toneMapRGB24(*buffers.returnFiltered(), buffers.returnDisplay(), 0.8f, 1.2f, 0.1f);
+        });
+        sweepThreads(threadCounts, "fused", type, radius, width, height, 15.0, [&](){
+          convolveToneMapRGB24(*source, buffers.returnDisplay(), radius, type, 0.8f, 1.2f, 0.1f);
+        });
+      }
+    }
+
+    sweepThreads(threadCounts, "toneMap", -1, 0, width, height, 24.0, [&](){
+      toneMap(*source, *buffers.returnFiltered(), 0.8f, 1.2f, 0.1f);
+    });
+    int widestPath = toneMapPath();
+    for(int path = TONEMAP_SCALAR; path <= widestPath; path++){
+      setToneMapPath(path);
+      sweepThreads(threadCounts, "toneMapRGB24", path, 0, width, height, 15.0, [&](){
+        toneMapRGB24(*source, buffers.returnDisplay(), 0.8f, 1.2f, 0.1f);
+      });
+    }
+    //the same image as an 8 bit source, which goes through the exact luminance table
+    planarImage bytes;
+    source->toRGB24(buffers.returnDisplay());
+    bytes.fromRGB24(buffers.returnDisplay(), width, height);
+    for(int path = TONEMAP_SCALAR; path <= widestPath; path++){
+      setToneMapPath(path);
+      sweepThreads(threadCounts, "toneMapRGB24_8bit", path, 0, width, height, 15.0, [&](){
+        toneMapRGB24(bytes, buffers.returnDisplay(), 0.8f, 1.2f, 0.1f);
+      });
+    }
+    setToneMapPath(widestPath);
+    //the other operators; filmic goes through the same tables, the local one is evaluated per pixel
+    sweepThreads(threadCounts, "toneMapRGB24_filmic", widestPath, 0, width, height, 15.0, [&](){
+      toneMapRGB24(*source, buffers.returnDisplay(), 1.0f, 1.0f, 4.0f, TONE_FILMIC);
+    });
+    sweepThreads(threadCounts, "toneMapRGB24_local", -1, 0, width, height, 15.0, [&](){
+      toneMapRGB24(*source, buffers.returnDisplay(), 1.0f, 1.0f, 4.0f, TONE_LOCAL);
+    });
+    toneStats stats;
+    sweepThreads(threadCounts, "measureTone", -1, 0, width, height, 12.0, [&](){
+      measureTone(*source, stats);
+    });
+
+    //file I/O is single threaded, so it is only measured once
+    ppm image;
+    image.setWidth(width);
+    image.setHeight(height);
+    image.setData(buffers.returnDisplay());
+    double seconds = timeBest([&](){ image.writeData(tempName); });
+    record("ppm::writeData", -1, 0, width, height, 1, seconds, 3.0, 0.0);
+    seconds = timeBest([&](){
+      ppm in;
+      in.readData(tempName);
+    });
+    record("ppm::readData", -1, 0, width, height, 1, seconds, 3.0, 0.0);
+    seconds = timeBest([&](){
+      ppm in;
+      in.mapData(tempName);
+      //touch every page so the mapping is actually read
+      const unsigned char* view = in.returnView();
+      unsigned sum = 0;
+      for(int i = 0; i < 3 * pixels; i = i + 4096){
+        sum = sum + view[i];
+      }
+      if(sum == 1) fprintf(stderr, " ");
+    });
+    record("ppm::mapData", -1, 0, width, height, 1, seconds, 3.0, 0.0);
+    //deeper formats go through floats: 16 bit samples are byte swapped, PFM rows copied as they are
+    std::vector<float> floats(3 * (size_t)pixels);
+    for(int y = 0; y < height; y++){
+      for(int x = 0; x < width; x++){
+        for(int c = 0; c < 3; c++){
+          floats[3 * ((size_t)y * width + x) + c] = source->returnRow(c, y)[x] * (1.0f / 255.0f);
+        }
+      }
+    }
+    const char* formatNames[2] = {"16bit", "pfm"};
+    for(int f = 0; f < 2; f++){
+      ppm deep;
+      deep.setWidth(width);
+      deep.setHeight(height);
+      deep.setFloatData(&floats[0]);
+      deep.setFormat(f == 0 ? PPM_BINARY : PPM_FLOAT, 65535);
+      double bytes = f == 0 ? 6.0 : 12.0;
+      seconds = timeBest([&](){ deep.writeData(tempName); });
+      record(string("ppm::writeData_") + formatNames[f], -1, 0, width, height, 1, seconds, 12.0 + bytes, 0.0);
+      seconds = timeBest([&](){
+        ppm in;
+        in.mapData(tempName);
+        for(int y = 0; y < height; y++){
+          in.readRow(y, &floats[3 * (size_t)y * width]);
+        }
+      });
+      record(string("ppm::readRow_") + formatNames[f], -1, 0, width, height, 1, seconds, 12.0 + bytes, 0.0);
+    }
+    remove(tempName);
+  }
+
+  printResults();
+  return 0;
+}
@@ -0,0 +1,289 @@
+#include "bilateral.h"
+#include "filter.h"
+#include "threadpool.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//grid rows each band slices; every band splats its own grid, plus a halo of GRID_PAD rows each side
+#define BILATERAL_BAND_CELLS 16
+//zero cells around the grid, so the 5 tap blur can read past its edges
+#define GRID_PAD 2
+//tabulated range weights are spaced 1 / BILATERAL_TABLE_STEPS sigma apart, out to 4 sigma
+#define BILATERAL_TABLE_STEPS 64
+
+static int pathOverride = BILATERAL_FAST;
+
+void setBilateralPath(int path){
+  pathOverride = path;
+}
+
+int bilateralPath(){
+  return pathOverride;
+}
+
+static float spatialSigma(int radius){
+  return radius / 2.0f;
+}
+
+//
+// Fills range with every pixel's log2 luminance in units of
+// BILATERAL_SIGMA_STOPS (so range differences are in sigmas), clamped at
+// BILATERAL_FLOOR of the brightest pixel. lowest and highest get the extremes.
+// Non-finite luminances (NaN or inf in a PFM) are taken as black, so the
+// range always spans at most log2(1 / BILATERAL_FLOOR) stops.
+//
+static void rangePlane(const planarImage& in, std::vector<float>& range, float& lowest, float& highest){
+  int width = in.returnWidth(), height = in.returnHeight();
+  range.resize((size_t)width * height);
+  std::vector<float> rowMax(height), rowMin(height);
+  sharedPool()->parallelFor(height, [&](int y){
+    const float* r = in.returnRow(0, y);
+    const float* g = in.returnRow(1, y);
+    const float* b = in.returnRow(2, y);
+    float* dst = &range[(size_t)y * width];
+    float brightest = 0.0f;
+    for(int x = 0; x < width; x++){
+      //same weights as the tone mapper's luminance
+      dst[x] = (20.0f * r[x] + 40.0f * g[x] + b[x]) / 61.0f;
+      if(!std::isfinite(dst[x])) dst[x] = 0.0f;
+      brightest = std::max(brightest, dst[x]);
+    }
+    rowMax[y] = brightest;
+  });
+  float floorLum = std::max(*std::max_element(rowMax.begin(), rowMax.end()) * BILATERAL_FLOOR, 1e-30f);
+  sharedPool()->parallelFor(height, [&](int y){
+    float* dst = &range[(size_t)y * width];
+    float low = 1e30f, high = -1e30f;
+    for(int x = 0; x < width; x++){
+      dst[x] = log2f(std::max(dst[x], floorLum)) / BILATERAL_SIGMA_STOPS;
+      low = std::min(low, dst[x]);
+      high = std::max(high, dst[x]);
+    }
+    rowMin[y] = low;
+    rowMax[y] = high;
+  });
+  lowest = *std::min_element(rowMin.begin(), rowMin.end());
+  highest = *std::max_element(rowMax.begin(), rowMax.end());
+}
+
+//range weight for a difference of d sigmas, straight from exp
+struct exactRange {
+  float operator()(float d) const {
+    return expf(-0.5f * d * d);
+  }
+};
+
+//the same weight interpolated from a table; past 4 sigma it stays at the last entry
+struct tableRange {
+  std::vector<float> table;
+  tableRange(){
+    this->table.resize(4 * BILATERAL_TABLE_STEPS + 2);
+    for(int i = 0; i <= 4 * BILATERAL_TABLE_STEPS; i++){
+      float d = (float)i / BILATERAL_TABLE_STEPS;
+      this->table[i] = expf(-0.5f * d * d);
+    }
+    this->table[4 * BILATERAL_TABLE_STEPS + 1] = this->table[4 * BILATERAL_TABLE_STEPS];
+  }
+  float operator()(float d) const {
+    float a = std::min(fabsf(d) * BILATERAL_TABLE_STEPS, (float)(4 * BILATERAL_TABLE_STEPS));
+    int i = (int)a;
+    return this->table[i] + (a - i) * (this->table[i + 1] - this->table[i]);
+  }
+};
+
+//sums the whole window of every pixel, with range weights from weight
+template<typename W>
+static void bilateralDirect(const planarImage& in, planarImage& out, int radius, const W& weight){
+  int width = in.returnWidth(), height = in.returnHeight();
+  int size = 2 * radius + 1;
+  float lowest, highest;
+  std::vector<float> range;
+  rangePlane(in, range, lowest, highest);
+  float sigma = spatialSigma(radius);
+  std::vector<float> spatial(size * size);
+  for(int dy = -radius; dy <= radius; dy++){
+    for(int dx = -radius; dx <= radius; dx++){
+      spatial[(dy + radius) * size + dx + radius] = expf(-(float)(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+    }
+  }
+  //entry x + radius holds the reflected index of x
+  std::vector<int> idxX(width + 2 * radius), idxY(height + 2 * radius);
+  for(int i = 0; i < (int)idxX.size(); i++){
+    idxX[i] = reflectIndex(i - radius, width);
+  }
+  for(int i = 0; i < (int)idxY.size(); i++){
+    idxY[i] = reflectIndex(i - radius, height);
+  }
+  out.resize(width, height);
+  sharedPool()->parallelFor(height, [&](int y){
+    const float* rows[3];
+    for(int x = 0; x < width; x++){
+      float centre = range[(size_t)y * width + x];
+      float sum[3] = {0.0f, 0.0f, 0.0f}, total = 0.0f;
+      for(int dy = 0; dy < size; dy++){
+        int sy = idxY[y + dy];
+        const float* lum = &range[(size_t)sy * width];
+        const float* k = &spatial[dy * size];
+        for(int c = 0; c < 3; c++){
+          rows[c] = in.returnRow(c, sy);
+        }
+        for(int dx = 0; dx < size; dx++){
+          int sx = idxX[x + dx];
+          float w = k[dx] * weight(lum[sx] - centre);
+          sum[0] = sum[0] + w * rows[0][sx];
+          sum[1] = sum[1] + w * rows[1][sx];
+          sum[2] = sum[2] + w * rows[2][sx];
+          total = total + w;
+        }
+      }
+      //the centre tap always has weight 1, so total is never 0
+      for(int c = 0; c < 3; c++){
+        out.returnRow(c, y)[x] = sum[c] / total;
+      }
+    }
+  });
+}
+
+void bilateralExact(const planarImage& in, planarImage& out, int radius){
+  bilateralDirect(in, out, radius, exactRange());
+}
+
+//
+// out = g[-2] + 4 g[-1] + 6 g[0] + 4 g[1] + g[2] along one axis of the grid,
+// whose cells are stride floats apart. Cells next to each other along the
+// other axes are contiguous, so each step filters a run of span floats at
+// once: for every o < outer and i < cells, the run starting at
+// begin + o * outerStride + i * stride. The kernel isn't normalized; slicing
+// divides the scale back out.
+//
+static void blurAxis(const float* g, float* out, int outer, long outerStride, int cells, long stride, long span, long begin){
+  for(int o = 0; o < outer; o++){
+    for(int i = 0; i < cells; i++){
+      long offset = begin + o * outerStride + i * stride;
+      const float* __restrict s = g + offset;
+      float* __restrict d = out + offset;
+      for(long f = 0; f < span; f++){
+        d[f] = s[f - 2 * stride] + 4.0f * (s[f - stride] + s[f + stride]) + 6.0f * s[f] + s[f + 2 * stride];
+      }
+    }
+  }
+}
+
+void bilateralGrid(const planarImage& in, planarImage& out, int radius){
+  int width = in.returnWidth(), height = in.returnHeight();
+  float lowest, highest;
+  std::vector<float> range;
+  rangePlane(in, range, lowest, highest);
+  float s = spatialSigma(radius);
+  //grid cells along each axis (before padding); cell i is centred on pixel i * s
+  int cellsX = (int)((width - 1) / s + 0.5f) + 1;
+  int cellsY = (int)((height - 1) / s + 0.5f) + 1;
+  int cellsZ = (int)(highest - lowest + 0.5f) + 1;
+  //each cell holds r, g, b and weight; z varies fastest so interpolation reads neighbouring pairs
+  long pitchZ = cellsZ + 2 * GRID_PAD, pitchX = cellsX + 2 * GRID_PAD;
+  long strideX = 4 * pitchZ, strideY = strideX * pitchX;
+  //nearest cell (for splatting) and lower cell plus fraction (for slicing) of every column
+  std::vector<int> nearX(width), lowX(width);
+  std::vector<float> fracX(width);
+  for(int x = 0; x < width; x++){
+    nearX[x] = (int)(x / s + 0.5f) + GRID_PAD;
+    lowX[x] = (int)(x / s);
+    fracX[x] = x / s - lowX[x];
+    lowX[x] = lowX[x] + GRID_PAD;
+  }
+  out.resize(width, height);
+  int bands = (cellsY + BILATERAL_BAND_CELLS - 1) / BILATERAL_BAND_CELLS;
+  //a band's grids run to megabytes at small radii and fresh pages cost more than the blur, so bands
+  //reuse the grids of earlier ones; there are never more than the pool has workers, and all are freed on return
+  std::vector<std::unique_ptr<std::vector<float> > > spare;
+  std::mutex spareLock;
+  sharedPool()->parallelFor(bands, [&](int band){
+    //slices pixels whose lower cell is in [cy0, cy1); interpolation reaches cy1 and the blur GRID_PAD past that
+    int cy0 = band * BILATERAL_BAND_CELLS, cy1 = std::min(cellsY, cy0 + BILATERAL_BAND_CELLS);
+    int first = cy0 - GRID_PAD, rows = cy1 - cy0 + 1 + 2 * GRID_PAD;
+    std::unique_ptr<std::vector<float> > grids;
+    {
+      std::unique_lock<std::mutex> guard(spareLock);
+      if(!spare.empty()){
+        grids = std::move(spare.back());
+        spare.pop_back();
+      }
+    }
+    if(!grids) grids.reset(new std::vector<float>());
+    //grid and blurred are the two halves of one allocation
+    grids->assign(2 * rows * strideY, 0.0f);
+    float* grid = &(*grids)[0];
+    float* blurred = grid + rows * strideY;
+    //splat every pixel whose nearest cell row is in the band's grid
+    int ya = std::max(0, (int)floorf((first - 0.5f) * s)), yb = std::min(height, (int)ceilf((first + rows - 0.5f) * s) + 1);
+    for(int y = ya; y < yb; y++){
+      int ly = (int)(y / s + 0.5f) - first;
+      if(ly < 0 || ly >= rows) continue;
+      float* cells = &grid[ly * strideY];
+      const float* lum = &range[(size_t)y * width];
+      const float* r = in.returnRow(0, y);
+      const float* g = in.returnRow(1, y);
+      const float* b = in.returnRow(2, y);
+      for(int x = 0; x < width; x++){
+        int z = (int)(lum[x] - lowest + 0.5f) + GRID_PAD;
+        float* cell = cells + nearX[x] * strideX + 4 * z;
+        cell[0] = cell[0] + r[x];
+        cell[1] = cell[1] + g[x];
+        cell[2] = cell[2] + b[x];
+        cell[3] = cell[3] + 1.0f;
+      }
+    }
+    //blur along z, then x, then y (only the rows that get sliced); the padding stays zero
+    blurAxis(grid, blurred, rows * pitchX, strideX, 1, 4, 4 * cellsZ, 4 * GRID_PAD);
+    blurAxis(blurred, grid, rows, strideY, cellsX, strideX, strideX, GRID_PAD * strideX);
+    blurAxis(grid, blurred, 1, 0, cy1 - cy0 + 1, strideY, strideY, GRID_PAD * strideY);
+    //slice: trilinear interpolation at each pixel's position and luminance
+    int y0 = (int)ceilf(cy0 * s), y1 = (cy1 == cellsY) ? height : std::min(height, (int)ceilf(cy1 * s));
+    for(int y = y0; y < y1; y++){
+      int cy = std::min((int)(y / s), cy1 - 1);
+      float ty = y / s - cy;
+      const float* cells = &blurred[(cy - first) * strideY];
+      const float* lum = &range[(size_t)y * width];
+      float* dst[3] = {out.returnRow(0, y), out.returnRow(1, y), out.returnRow(2, y)};
+      for(int x = 0; x < width; x++){
+        float z = lum[x] - lowest;
+        int cz = (int)z;
+        float tz = z - cz, tx = fracX[x];
+        const float* cell = cells + lowX[x] * strideX + 4 * (cz + GRID_PAD);
+        float acc[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for(int k = 0; k < 4; k++){
+          float near = (1.0f - tx) * ((1.0f - tz) * cell[k] + tz * cell[k + 4]) +
+                       tx * ((1.0f - tz) * cell[k + strideX] + tz * cell[k + strideX + 4]);
+          const float* next = cell + strideY;
+          float far = (1.0f - tx) * ((1.0f - tz) * next[k] + tz * next[k + 4]) +
+                      tx * ((1.0f - tz) * next[k + strideX] + tz * next[k + strideX + 4]);
+          acc[k] = (1.0f - ty) * near + ty * far;
+        }
+        //every pixel splatted within half a cell of where it is read back, so acc[3] > 0
+        for(int c = 0; c < 3; c++){
+          dst[c][x] = acc[c] / acc[3];
+        }
+      }
+    }
+    std::unique_lock<std::mutex> guard(spareLock);
+    spare.push_back(std::move(grids));
+  });
+}
+
+void bilateral(const planarImage& in, planarImage& out, int radius){
+  static profileStage* stage = profileStageFor("bilateral");
+  scopedTimer timer(stage, (long long)in.returnWidth() * in.returnHeight());
+  if(pathOverride == BILATERAL_EXACT){
+    bilateralExact(in, out, radius);
+  } else if(radius < BILATERAL_GRID_MIN_RADIUS){
+    static const tableRange weights;
+    bilateralDirect(in, out, radius, weights);
+  } else {
+    bilateralGrid(in, out, radius);
+  }
+}
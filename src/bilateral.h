@@ -0,0 +1,55 @@
+#ifndef BILATERAL_H
+#define BILATERAL_H
+
+#include "image.h"
+
+//which implementation convolution() runs KERNEL_BILATERAL on
+#define BILATERAL_FAST 0
+#define BILATERAL_EXACT 1
+
+//range sigma: pixels this many stops of luminance apart weigh e^-0.5 as much as equal ones
+#define BILATERAL_SIGMA_STOPS 0.5f
+//luminance floor relative to the brightest pixel, so black isn't infinitely many stops down
+#define BILATERAL_FLOOR (1.0f / 1024.0f)
+//smaller radii are summed directly; their grid would be almost as fine as the image
+#define BILATERAL_GRID_MIN_RADIUS 3
+
+//
+// Edge preserving blur. Each output is the average of the pixels within
+// radius, weighted by a spatial gaussian (sigma = radius / 2) and by a range
+// gaussian on the difference of their log luminances, so smoothing stops at
+// edges. All three channels share the weights. Borders are reflected.
+//
+// Radii from BILATERAL_GRID_MIN_RADIUS up run through bilateralGrid(), so
+// the cost per pixel does not grow with radius; smaller ones sum the window
+// directly with tabulated range weights. setBilateralPath(BILATERAL_EXACT)
+// switches every radius to bilateralExact().
+//
+// \param in input image
+// \param out output image, resized to match in (must not be in)
+// \param radius window radius in pixels
+//
+void bilateral(const planarImage& in, planarImage& out, int radius);
+
+//
+// Bilateral grid approximation (Paris and Durand): pixels are summed into
+// cells sigma_s pixels wide and BILATERAL_SIGMA_STOPS deep in log luminance,
+// the grid is blurred with a 5 tap binomial along each axis, and every output
+// is read back by trilinear interpolation at its own position and luminance.
+// Grid cells grow with radius, so larger radii are cheaper. The image is done
+// in bands of grid rows, each with its own small grid, spread over the pool.
+//
+void bilateralGrid(const planarImage& in, planarImage& out, int radius);
+
+//
+// Brute force reference: sums the whole (2 * radius + 1)^2 window with every
+// weight computed by exp. O(radius^2) per pixel; meant for validating the
+// fast paths, not for interactive use.
+//
+void bilateralExact(const planarImage& in, planarImage& out, int radius);
+
+//forces bilateral() onto the exact reference (BILATERAL_FAST restores the usual choice)
+void setBilateralPath(int path);
+int bilateralPath();
+
+#endif
@@ -0,0 +1,276 @@
+#include "fft.h"
+#include "filter.h"
+#include "threadpool.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+typedef std::complex<double> complexd;
+
+//columns gathered together in the vertical pass so each gather reads whole cache lines
+#define FFT_COLUMN_GROUP 8
+//tiles up to this size run one per thread; larger ones spread each transform over the pool
+#define FFT_TILE_PARALLEL_MAX 256
+//cost of one radix-2 butterfly measured in spatial kernel taps (multiply-adds of one channel)
+#define FFT_BUTTERFLY_COST 6.0
+
+static int pathOverride = CONVOLUTION_AUTO;
+
+void setConvolutionPath(int path){
+  pathOverride = path;
+}
+
+int convolutionPath(){
+  return pathOverride;
+}
+
+static int nextPowerOfTwo(int n){
+  int p = 1;
+  while(p < n) p = p * 2;
+  return p;
+}
+
+int fftTileSize(int width, int height, int radius){
+  //at least half of each tile side is output, unless the whole image fits in a smaller one
+  int halo = 2 * radius;
+  int size = nextPowerOfTwo(2 * (halo + 1));
+  return std::min(size, nextPowerOfTwo(std::max(width, height) + halo));
+}
+
+bool preferFFT(int width, int height, int radius, int type){
+  if(pathOverride != CONVOLUTION_AUTO) return pathOverride == CONVOLUTION_FFT;
+  //the box, and sharpen with it, cost the same at any radius
+  if(radius <= FIXED_RADIUS_MAX || type != KERNEL_GAUSSIAN) return false;
+  double taps = 2.0 * radius + 1.0;
+  double spatial = 2.0 * taps;
+  //per tile: forward and inverse 2D transforms for the red/green and blue passes
+  double n = fftTileSize(width, height, radius);
+  double block = n - 2.0 * radius;
+  double butterflies = 4.0 * (n * n / 2.0) * log2(n * n);
+  double tiles = ceil(width / block) * ceil(height / block);
+  double fft = tiles * (butterflies * FFT_BUTTERFLY_COST + 4.0 * n * n) / (3.0 * width * height);
+  return fft < spatial;
+}
+
+//twiddles and bit reversal for one transform size
+struct fftPlan {
+  int size;
+  std::vector<int> reverse;
+  std::vector<complexd> forward;
+  std::vector<complexd> inverse;
+};
+
+static void buildPlan(int size, fftPlan& plan){
+  int bits = 0;
+  while((1 << bits) < size) bits++;
+  plan.size = size;
+  plan.reverse.resize(size);
+  for(int i = 0; i < size; i++){
+    int r = 0;
+    for(int b = 0; b < bits; b++){
+      if(i & (1 << b)) r = r | (1 << (bits - 1 - b));
+    }
+    plan.reverse[i] = r;
+  }
+  plan.forward.resize(size / 2);
+  plan.inverse.resize(size / 2);
+  for(int i = 0; i < size / 2; i++){
+    double angle = -2.0 * M_PI * i / size;
+    plan.forward[i] = complexd(cos(angle), sin(angle));
+    plan.inverse[i] = complexd(cos(angle), -sin(angle));
+  }
+}
+
+//complex product written out; std::complex's operator* checks for infinities on every call
+static inline complexd multiply(const complexd& a, const complexd& b){
+  return complexd(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+}
+
+//in place iterative radix-2 transform of size contiguous values; inverse leaves out the 1/n scale
+static void transform(complexd* v, const fftPlan& plan, bool inverse){
+  int n = plan.size;
+  const complexd* twiddle = inverse ? &plan.inverse[0] : &plan.forward[0];
+  for(int i = 0; i < n; i++){
+    if(i < plan.reverse[i]) std::swap(v[i], v[plan.reverse[i]]);
+  }
+  for(int len = 2; len <= n; len = len * 2){
+    int half = len / 2, step = n / len;
+    for(int i = 0; i < n; i += len){
+      for(int j = 0; j < half; j++){
+        complexd a = v[i + j];
+        complexd b = multiply(v[i + j + half], twiddle[j * step]);
+        v[i + j] = a + b;
+        v[i + j + half] = a - b;
+      }
+    }
+  }
+}
+
+//runs fn(i) for i in [0, count), over the pool when parallel is set
+static void forEach(int count, bool parallel, const std::function<void(int)>& fn){
+  if(parallel){
+    sharedPool()->parallelFor(count, fn);
+    return;
+  }
+  for(int i = 0; i < count; i++){
+    fn(i);
+  }
+}
+
+//2D transform of a size x size grid: every row, then every column
+static void transform2D(complexd* grid, const fftPlan& plan, bool inverse, bool parallel){
+  int n = plan.size;
+  forEach(n, parallel, [&](int y){
+    transform(grid + (size_t)y * n, plan, inverse);
+  });
+  int groups = (n + FFT_COLUMN_GROUP - 1) / FFT_COLUMN_GROUP;
+  forEach(groups, parallel, [&](int g){
+    int x0 = g * FFT_COLUMN_GROUP, x1 = std::min(n, x0 + FFT_COLUMN_GROUP);
+    std::vector<complexd> columns((size_t)(x1 - x0) * n);
+    for(int y = 0; y < n; y++){
+      for(int x = x0; x < x1; x++){
+        columns[(size_t)(x - x0) * n + y] = grid[(size_t)y * n + x];
+      }
+    }
+    for(int x = x0; x < x1; x++){
+      transform(&columns[(size_t)(x - x0) * n], plan, inverse);
+    }
+    for(int y = 0; y < n; y++){
+      for(int x = x0; x < x1; x++){
+        grid[(size_t)y * n + x] = columns[(size_t)(x - x0) * n + y];
+      }
+    }
+  });
+}
+
+//a kernel ready to multiply against tiles of one size
+struct fftKernel {
+  int size;
+  int radius;
+  int type;
+  fftPlan plan;
+  std::vector<complexd> spectrum;
+};
+
+//spectrum of the last kernel used, shared by every call that asks for the same one
+static std::mutex spectrumLock;
+static std::shared_ptr<const fftKernel> cachedKernel;
+
+//
+// Returns the plan and spectrum for a size x size tile. The kernel is flipped
+// and wrapped around the origin so the circular product lines each output up
+// with the input pixel it is centred on, and the inverse transform's 1/n^2
+// scale is folded in.
+//
+static std::shared_ptr<const fftKernel> kernelSpectrum(int size, int radius, int type){
+  std::unique_lock<std::mutex> guard(spectrumLock);
+  if(cachedKernel && cachedKernel->size == size && cachedKernel->radius == radius && cachedKernel->type == type){
+    return cachedKernel;
+  }
+  std::shared_ptr<fftKernel> k(new fftKernel());
+  std::vector<float> kernel;
+  buildKernel2D(radius, type, kernel);
+  int taps = 2 * radius + 1;
+  k->size = size;
+  k->radius = radius;
+  k->type = type;
+  buildPlan(size, k->plan);
+  k->spectrum.assign((size_t)size * size, complexd(0.0, 0.0));
+  double scale = 1.0 / ((double)size * size);
+  for(int dy = -radius; dy <= radius; dy++){
+    for(int dx = -radius; dx <= radius; dx++){
+      int y = (dy + size) % size, x = (dx + size) % size;
+      k->spectrum[(size_t)y * size + x] = kernel[(radius - dy) * taps + (radius - dx)] * scale;
+    }
+  }
+  transform2D(&k->spectrum[0], k->plan, false, true);
+  cachedKernel = k;
+  return cachedKernel;
+}
+
+//
+// Filters the block whose top left output pixel is (x0, y0). grid is size x
+// size scratch; the input tile starts radius pixels up and left of the block,
+// and only its interior is free of the circular wrap.
+//
+static void convolveTile(const planarImage& in, planarImage& out, int radius, const fftKernel& kernel,
+                         const std::vector<int>& idxX, const std::vector<int>& idxY, int x0, int y0, complexd* grid, bool parallel){
+  int width = in.returnWidth(), height = in.returnHeight();
+  int size = kernel.size;
+  int block = size - 2 * radius;
+  int rows = std::min(block, height - y0), cols = std::min(block, width - x0);
+  //two passes: red and green packed as one complex signal, then blue alone
+  for(int pass = 0; pass < 2; pass++){
+    forEach(size, parallel, [&](int y){
+      const float* first = in.returnRow(pass == 0 ? 0 : 2, idxY[y0 + y]);
+      const float* second = in.returnRow(1, idxY[y0 + y]);
+      complexd* dst = grid + (size_t)y * size;
+      for(int x = 0; x < size; x++){
+        int i = idxX[x0 + x];
+        dst[x] = complexd(first[i], (pass == 0) ? second[i] : 0.0f);
+      }
+    });
+    transform2D(grid, kernel.plan, false, parallel);
+    forEach(size, parallel, [&](int y){
+      complexd* row = grid + (size_t)y * size;
+      const complexd* k = &kernel.spectrum[(size_t)y * size];
+      for(int x = 0; x < size; x++){
+        row[x] = multiply(row[x], k[x]);
+      }
+    });
+    transform2D(grid, kernel.plan, true, parallel);
+    forEach(rows, parallel, [&](int y){
+      const complexd* src = grid + (size_t)(y + radius) * size + radius;
+      float* first = out.returnRow(pass == 0 ? 0 : 2, y0 + y) + x0;
+      float* second = out.returnRow(1, y0 + y) + x0;
+      for(int x = 0; x < cols; x++){
+        first[x] = (float)src[x].real();
+        if(pass == 0) second[x] = (float)src[x].imag();
+      }
+    });
+  }
+}
+
+void fftConvolution(const planarImage& in, planarImage& out, int radius, int type){
+  int width = in.returnWidth(), height = in.returnHeight();
+  static profileStage* stage = profileStageFor("fftConvolution");
+  scopedTimer timer(stage, (long long)width * height);
+  if(radius < 1){
+    out = in;
+    return;
+  }
+  out.resize(width, height);
+  int size = fftTileSize(width, height, radius);
+  int block = size - 2 * radius;
+  std::shared_ptr<const fftKernel> kernel = kernelSpectrum(size, radius, type);
+
+  //reflected source row/column for every tile position, halo included
+  int tilesX = (width + block - 1) / block, tilesY = (height + block - 1) / block;
+  std::vector<int> idxX(tilesX * block + 2 * radius), idxY(tilesY * block + 2 * radius);
+  for(int i = 0; i < (int)idxX.size(); i++){
+    idxX[i] = reflectIndex(i - radius, width);
+  }
+  for(int i = 0; i < (int)idxY.size(); i++){
+    idxY[i] = reflectIndex(i - radius, height);
+  }
+
+  if(size <= FFT_TILE_PARALLEL_MAX){
+    //small tiles: each thread takes whole tiles with its own scratch grid
+    sharedPool()->parallelFor(tilesX * tilesY, [&](int t){
+      std::vector<complexd> grid((size_t)size * size);
+      convolveTile(in, out, radius, *kernel, idxX, idxY, (t % tilesX) * block, (t / tilesX) * block, &grid[0], false);
+    });
+  } else {
+    //large tiles: one scratch grid, every transform spread over the pool
+    std::vector<complexd> grid((size_t)size * size);
+    for(int t = 0; t < tilesX * tilesY; t++){
+      convolveTile(in, out, radius, *kernel, idxX, idxY, (t % tilesX) * block, (t / tilesX) * block, &grid[0], true);
+    }
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include "image.h"
+
+//which backend convolution() runs large kernels on
+#define CONVOLUTION_AUTO 0
+#define CONVOLUTION_SPATIAL 1
+#define CONVOLUTION_FFT 2
+
+//
+// Convolves a planar RGB image through the frequency domain, with the
+// same kernels and reflected borders as convolution(). The image is cut into
+// fixed size tiles that are transformed one at a time (overlap-save: each
+// N x N input tile, halo included, yields its (N - 2 * radius)^2 interior), so
+// memory stays at one tile plus the kernel spectrum however large the image.
+// Red and green share one complex transform, blue gets its own. The spectrum
+// of the last kernel used is cached, so repeated calls with the same radius
+// and type (new frames, new images of similar size) skip rebuilding it.
+//
+// \param in input image
+// \param out output image, resized to match in (must not be in)
+// \param radius kernel radius in pixels
+// \param type KERNEL_BOX, KERNEL_GAUSSIAN, or anything else for sharpen
+//
+void fftConvolution(const planarImage& in, planarImage& out, int radius, int type);
+
+//
+// Cost model used by convolution(): true when the FFT path is expected to be
+// faster than the spatial one for this image and kernel. The box filter never
+// qualifies, since its running sums cost the same at any radius, nor does
+// sharpen, which convolution() runs as a box, and neither do radii up to
+// FIXED_RADIUS_MAX, whose specialized kernels the model does not cover (they
+// beat the transforms at every size measured).
+//
+bool preferFFT(int width, int height, int radius, int type);
+
+//side of the square tile fftConvolution uses (a power of two)
+int fftTileSize(int width, int height, int radius);
+
+//forces convolution() onto one backend (CONVOLUTION_AUTO restores the cost model)
+void setConvolutionPath(int path);
+int convolutionPath();
+
+#endif
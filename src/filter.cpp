@@ -0,0 +1,280 @@
+#include "filter.h"
+#include "threadpool.h"
+#include "fft.h"
+#include "bilateral.h"
+#include "kernels.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+//mirrors i about the image edges without repeating the edge pixel
+int reflectIndex(int i, int n){
+  if(n == 1) return 0;
+  int period = 2 * n - 2;
+  i = i % period;
+  if(i < 0) i = i + period;
+  return (i < n) ? i : period - i;
+}
+
+bool isSeparable(int type){
+  return type == KERNEL_BOX || type == KERNEL_GAUSSIAN;
+}
+
+void buildKernel1D(int radius, int type, std::vector<float>& kernel){
+  int i, size = 2 * radius + 1;
+  double sum = 0.0, sigma = radius / 3.0;
+  std::vector<double> weights(size);
+  for(i = 0; i < size; i++){
+    if(type == KERNEL_GAUSSIAN){
+      double d = i - radius;
+      weights[i] = exp(-(d * d) / (2.0 * sigma * sigma));
+    } else {
+      weights[i] = 1.0;
+    }
+    sum = sum + weights[i];
+  }
+  kernel.resize(size);
+  for(i = 0; i < size; i++){
+    kernel[i] = (float)(weights[i] / sum);
+  }
+}
+
+void buildKernel2D(int radius, int type, std::vector<float>& kernel){
+  int i, j, size = 2 * radius + 1;
+  kernel.resize(size * size);
+  //separable kernels are the outer product of their 1D weights
+  if(isSeparable(type)){
+    std::vector<float> k1;
+    buildKernel1D(radius, type, k1);
+    for(i = 0; i < size; i++){
+      for(j = 0; j < size; j++){
+        kernel[i * size + j] = k1[i] * k1[j];
+      }
+    }
+    return;
+  }
+  //sharpen: every tap is -1 except the centre, which balances them out
+  for(i = 0; i < size * size; i++){
+    kernel[i] = -1.0f;
+  }
+  kernel[radius * size + radius] = (float)(size * size) - 1.0f;
+}
+
+//builds a table mapping x + radius (for x in [-radius, n + radius]) to a reflected index
+static void buildReflectTable(int n, int radius, std::vector<int>& table){
+  table.resize(n + 2 * radius + 1);
+  for(int i = 0; i < (int)table.size(); i++){
+    table[i] = reflectIndex(i - radius, n);
+  }
+}
+
+//floats per tile row in the vertical passes; keeps a tile's running sums in L1
+#define TILE_FLOATS 1024
+//rows per tile in the horizontal passes
+#define TILE_ROWS 16
+
+//
+// Splits a rows x cols region of the first planes planes into tiles and runs
+// fn(channel, y0, y1, x0, x1) on each one through the shared pool. Tiles only
+// depend on the sizes passed in, never on the thread count, so the output is
+// the same however many threads run. Each tile reads its halo straight from
+// the shared input.
+//
+static void forEachTile(int planes, int rows, int cols, int tileRows, int tileCols, const std::function<void(int, int, int, int, int)>& fn){
+  int bandsY = (rows + tileRows - 1) / tileRows;
+  int bandsX = (cols + tileCols - 1) / tileCols;
+  int perPlane = bandsY * bandsX;
+  sharedPool()->parallelFor(planes * perPlane, [&](int t){
+    int c = t / perPlane;
+    int y0 = ((t % perPlane) / bandsX) * tileRows;
+    int x0 = ((t % perPlane) % bandsX) * tileCols;
+    fn(c, y0, std::min(rows, y0 + tileRows), x0, std::min(cols, x0 + tileCols));
+  });
+}
+
+//
+// Copies count reflected samples starting at idx[first] into pad, so taps can
+// read pad[x + t] with no index lookups, and zeroes the rest of pad up to
+// size (the tail whole-block loops read past the real samples).
+//
+static void padRow(const float* row, std::vector<float>& pad, const std::vector<int>& idx, int first, int count){
+  for(int i = 0; i < count; i++){
+    pad[i] = row[idx[first + i]];
+  }
+  for(int i = count; i < (int)pad.size(); i++){
+    pad[i] = 0.0f;
+  }
+}
+
+//zeroes [0, alignedSpan(count)) of dst
+static void clearSpan(float* dst, int count){
+  for(int x = 0; x < alignedSpan(count); x++){
+    dst[x] = 0.0f;
+  }
+}
+
+//horizontal box filter, one running sum per row so each pixel costs O(1)
+static void boxRows(const planarImage& in, planarImage& out, int c, int radius, const std::vector<int>& idx, int y0, int y1){
+  int width = in.returnWidth();
+  double inv = 1.0 / (2.0 * radius + 1.0);
+  std::vector<float> pad(width + 2 * radius + 1);
+  for(int y = y0; y < y1; y++){
+    float* dst = out.returnRow(c, y);
+    padRow(in.returnRow(c, y), pad, idx, 0, (int)pad.size());
+    double sum = 0.0;
+    for(int t = 0; t < 2 * radius + 1; t++){
+      sum = sum + pad[t];
+    }
+    for(int x = 0; x < width; x++){
+      dst[x] = (float)(sum * inv);
+      sum = sum + pad[x + 2 * radius + 1] - pad[x];
+    }
+  }
+}
+
+//
+// Vertical box filter; keeps a running sum per column and slides it down the
+// tile. Columns are processed in whole PLANE_ALIGN blocks (x0 is always
+// block aligned), which is what lets the inner loops vectorize.
+//
+static void boxColumns(const planarImage& in, planarImage& out, int c, int radius, const std::vector<int>& idx, int y0, int y1, int x0, int x1){
+  double inv = 1.0 / (2.0 * radius + 1.0);
+  double sums[TILE_FLOATS];
+  int span = alignedSpan(x1 - x0);
+  for(int x = 0; x < span; x++){
+    sums[x] = 0.0;
+  }
+  for(int t = y0; t < y0 + 2 * radius + 1; t++){
+    const float* src = in.returnRow(c, idx[t]) + x0;
+    for(int x = 0; x < span; x += PLANE_ALIGN){
+      for(int k = 0; k < PLANE_ALIGN; k++){
+        sums[x + k] = sums[x + k] + src[x + k];
+      }
+    }
+  }
+  for(int y = y0; y < y1; y++){
+    float* __restrict dst = out.returnRow(c, y) + x0;
+    const float* add = in.returnRow(c, idx[y + 2 * radius + 1]) + x0;
+    const float* sub = in.returnRow(c, idx[y]) + x0;
+    for(int x = 0; x < span; x += PLANE_ALIGN){
+      for(int k = 0; k < PLANE_ALIGN; k++){
+        dst[x + k] = (float)(sums[x + k] * inv);
+        sums[x + k] = sums[x + k] + add[x + k] - sub[x + k];
+      }
+    }
+  }
+}
+
+//horizontal pass of a general separable kernel, accumulated a whole padded row per tap
+static void separableRows(const planarImage& in, planarImage& out, int c, const std::vector<float>& kernel, const std::vector<int>& idx, int y0, int y1){
+  int width = in.returnWidth();
+  std::vector<float> pad(alignedSpan(width) + kernel.size() - 1);
+  for(int y = y0; y < y1; y++){
+    float* dst = out.returnRow(c, y);
+    padRow(in.returnRow(c, y), pad, idx, 0, width + (int)kernel.size() - 1);
+    clearSpan(dst, width);
+    for(int t = 0; t < (int)kernel.size(); t++){
+      accumulateSpan(dst, &pad[t], kernel[t], width);
+    }
+  }
+}
+
+//vertical pass of a general separable kernel, accumulated a tile row per tap
+static void separableColumns(const planarImage& in, planarImage& out, int c, const std::vector<float>& kernel, const std::vector<int>& idx, int y0, int y1, int x0, int x1){
+  for(int y = y0; y < y1; y++){
+    float* dst = out.returnRow(c, y) + x0;
+    clearSpan(dst, x1 - x0);
+    for(int t = 0; t < (int)kernel.size(); t++){
+      accumulateSpan(dst, in.returnRow(c, idx[y + t]) + x0, kernel[t], x1 - x0);
+    }
+  }
+}
+
+//the box, gaussian and sharpen passes of convolution() over the first planes planes of in; out is already sized
+static void convolvePlanes(const planarImage& in, planarImage& out, int planes, int radius, int type, planarImage* scratch){
+  int width = in.returnWidth(), height = in.returnHeight();
+  std::vector<int> idxX, idxY;
+  buildReflectTable(width, radius, idxX);
+  buildReflectTable(height, radius, idxY);
+  const fixedKernel* fixed = (radius <= FIXED_RADIUS_MAX) ? &fixedKernelFor(radius) : NULL;
+  //sharpen is size^2 times the centre minus the window's sum, or size^2 * (in - box(in)), so it runs as a box
+  bool sharpen = !isSeparable(type);
+  if(sharpen) type = KERNEL_BOX;
+  //intermediate result of the horizontal pass
+  planarImage temp;
+  planarImage* mid = (scratch != NULL) ? scratch : &temp;
+  mid->resize(width, height);
+  std::vector<float> kernel;
+  buildKernel1D(radius, type, kernel);
+  if(fixed != NULL){
+    //up to FIXED_RADIUS_MAX even the box is cheaper as unrolled taps than as running sums
+    forEachTile(planes, height, 1, TILE_ROWS, 1, [&](int c, int y0, int y1, int, int){
+      fixed->rows(in, *mid, c, &kernel[0], idxX, y0, y1);
+    });
+    forEachTile(planes, height, width, TILE_ROWS, TILE_FLOATS, [&](int c, int y0, int y1, int x0, int x1){
+      fixed->columns(*mid, out, c, &kernel[0], idxY, y0, y1, x0, x1);
+    });
+  } else if(type == KERNEL_BOX){
+    forEachTile(planes, height, 1, TILE_ROWS, 1, [&](int c, int y0, int y1, int, int){
+      boxRows(in, *mid, c, radius, idxX, y0, y1);
+    });
+    //tall tiles so refilling the running sums over the halo stays a small share of the work
+    int rows = std::max(64, 4 * (2 * radius + 1));
+    forEachTile(planes, height, width, rows, TILE_FLOATS, [&](int c, int y0, int y1, int x0, int x1){
+      boxColumns(*mid, out, c, radius, idxY, y0, y1, x0, x1);
+    });
+  } else {
+    forEachTile(planes, height, 1, TILE_ROWS, 1, [&](int c, int y0, int y1, int, int){
+      separableRows(in, *mid, c, kernel, idxX, y0, y1);
+    });
+    forEachTile(planes, height, width, TILE_ROWS, TILE_FLOATS, [&](int c, int y0, int y1, int x0, int x1){
+      separableColumns(*mid, out, c, kernel, idxY, y0, y1, x0, x1);
+    });
+  }
+  if(sharpen){
+    float centre = (float)((2 * radius + 1) * (2 * radius + 1));
+    forEachTile(planes, height, width, TILE_ROWS, TILE_FLOATS, [&](int c, int y0, int y1, int x0, int x1){
+      for(int y = y0; y < y1; y++){
+        const float* src = in.returnRow(c, y) + x0;
+        float* dst = out.returnRow(c, y) + x0;
+        for(int x = 0; x < alignedSpan(x1 - x0); x++){
+          dst[x] = centre * (src[x] - dst[x]);
+        }
+      }
+    });
+  }
+}
+
+void convolution(const planarImage& in, planarImage& out, int radius, int type, planarImage* scratch){
+  int width = in.returnWidth(), height = in.returnHeight();
+  static profileStage* stage = profileStageFor("convolution");
+  scopedTimer timer(stage, (long long)width * height);
+  if(radius < 1){
+    out = in;
+    return;
+  }
+  if(type == KERNEL_BILATERAL){
+    bilateral(in, out, radius);
+    return;
+  }
+  out.resize(width, height);
+  //large kernels are cheaper as a product in the frequency domain
+  if(preferFFT(width, height, radius, type)){
+    fftConvolution(in, out, radius, type);
+    return;
+  }
+  convolvePlanes(in, out, 3, radius, type, scratch);
+}
+
+void convolvePlane(const planarImage& in, planarImage& out, int radius, int type){
+  out.resize(in.returnWidth(), in.returnHeight());
+  if(radius < 1){
+    for(int y = 0; y < in.returnHeight(); y++){
+      std::copy(in.returnRow(0, y), in.returnRow(0, y) + in.returnWidth(), out.returnRow(0, y));
+    }
+    return;
+  }
+  convolvePlanes(in, out, 1, radius, type, NULL);
+}
@@ -0,0 +1,61 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "image.h"
+
+#include <cstddef>
+#include <vector>
+
+//kernel types selected with n/m in the viewer
+#define KERNEL_BOX 0
+#define KERNEL_GAUSSIAN 1
+#define KERNEL_SHARPEN 2
+//edge preserving blur (see bilateral.h)
+#define KERNEL_BILATERAL 3
+//no convolution, only tone mapping (headless modes)
+#define KERNEL_NONE -2
+//largest radius with compile-time specialized kernels; larger ones run the generic passes
+#define FIXED_RADIUS_MAX 8
+
+//
+// Convolves a planar RGB image with the kernel picked by type, one channel at
+// a time. Box and gaussian kernels are separable and run as two 1D passes;
+// sharpen runs as the box, subtracted from the centre pixel and scaled by
+// the window's area. Borders are reflected. Radii up to FIXED_RADIUS_MAX use
+// passes compiled for that radius (see kernels.h); past that the box runs as
+// a running sum, so its cost (and sharpen's) does not depend on radius. When
+// the cost model in fft.h expects it to be faster (large gaussian kernels),
+// the work goes to fftConvolution() instead. KERNEL_BILATERAL isn't a
+// convolution at all and goes to bilateral().
+//
+// \param in input image
+// \param out output image, resized to match in (must not be in)
+// \param radius kernel radius in pixels
+// \param type KERNEL_BOX, KERNEL_GAUSSIAN, KERNEL_BILATERAL, or anything else
+//        for sharpen
+// \param scratch optional image for the intermediate pass; allocated per
+//        call when NULL
+//
+void convolution(const planarImage& in, planarImage& out, int radius, int type, planarImage* scratch = NULL);
+
+//
+// convolution() of channel 0 alone, for single plane images such as the
+// local tone mapper's adaptation image. Box, gaussian and sharpen only; it
+// never goes to the FFT and isn't recorded as a "convolution" profile stage.
+// Channels 1 and 2 of out are left unset.
+//
+void convolvePlane(const planarImage& in, planarImage& out, int radius, int type);
+
+//returns true if the kernel for type can be run as two 1D passes
+bool isSeparable(int type);
+
+//fills kernel with the normalized 1D weights (2 * radius + 1 taps) for a separable type
+void buildKernel1D(int radius, int type, std::vector<float>& kernel);
+
+//fills kernel with the row-major (2 * radius + 1)^2 weights for any type
+void buildKernel2D(int radius, int type, std::vector<float>& kernel);
+
+//mirrors an out of range index back into [0, n)
+int reflectIndex(int i, int n);
+
+#endif
@@ -0,0 +1,58 @@
+#include "framebuffer.h"
+#include "profile.h"
+
+//the display frame starts on its own cache line
+#define BUFFER_ALIGN 64
+
+frameBuffers::frameBuffers(){
+  this->block = NULL;
+  this->capacity = 0;
+  this->display = NULL;
+  this->width = 0;
+  this->height = 0;
+}
+
+frameBuffers::~frameBuffers(){
+  delete[] this->block;
+}
+
+void frameBuffers::resize(int width, int height){
+  size_t needed = 3 * (size_t)width * height;
+  this->source.resize(width, height);
+  this->scratch.resize(width, height);
+  this->filtered.resize(width, height);
+  if(needed > this->capacity){
+    delete[] this->block;
+    //extra room so the frame can be aligned
+    this->block = new unsigned char[needed + BUFFER_ALIGN];
+    this->capacity = needed;
+    profileAllocation(needed + BUFFER_ALIGN);
+  }
+  this->display = this->block + (BUFFER_ALIGN - (size_t)this->block % BUFFER_ALIGN) % BUFFER_ALIGN;
+  this->width = width;
+  this->height = height;
+}
+
+planarImage* frameBuffers::returnSource(){
+  return &this->source;
+}
+
+planarImage* frameBuffers::returnScratch(){
+  return &this->scratch;
+}
+
+planarImage* frameBuffers::returnFiltered(){
+  return &this->filtered;
+}
+
+unsigned char* frameBuffers::returnDisplay(){
+  return this->display;
+}
+
+int frameBuffers::returnWidth(){
+  return this->width;
+}
+
+int frameBuffers::returnHeight(){
+  return this->height;
+}
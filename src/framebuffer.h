@@ -0,0 +1,43 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "image.h"
+
+#include <cstddef>
+
+//
+// Owns every per-frame buffer the viewer needs. Each one keeps its storage
+// across loads and is only reallocated when a larger image arrives, so the
+// filter and tone map stages write into these instead of allocating on each
+// keypress.
+//
+class frameBuffers {
+  private:
+    planarImage source;
+    planarImage scratch;
+    planarImage filtered;
+    unsigned char* block;
+    size_t capacity;
+    unsigned char* display;
+    int width;
+    int height;
+  public:
+    frameBuffers();
+    ~frameBuffers();
+    frameBuffers(const frameBuffers&) = delete;
+    frameBuffers& operator=(const frameBuffers&) = delete;
+    //makes room for a width x height image, keeping the old storage if it is big enough
+    void resize(int width, int height);
+    //float copy of the loaded image
+    planarImage* returnSource();
+    //intermediate storage for the first pass of separable filters
+    planarImage* returnScratch();
+    //output of the filter stage
+    planarImage* returnFiltered();
+    //RGB24 frame handed to SDL and written out on exit
+    unsigned char* returnDisplay();
+    int returnWidth();
+    int returnHeight();
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include "fused.h"
+#include "filter.h"
+#include "kernels.h"
+#include "threadpool.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+bool fusedSupported(int radius, int type, int op){
+  return radius >= 1 && radius <= FIXED_RADIUS_MAX && type != KERNEL_BILATERAL && type != KERNEL_NONE && op != TONE_LOCAL;
+}
+
+void convolveToneMapRGB24(const planarImage& in, unsigned char* out, int radius, int type, float gamma, float gain, float bias,
+                          int op, planarImage* scratch){
+  int width = in.returnWidth(), height = in.returnHeight();
+  if(radius < 1 || type == KERNEL_NONE){
+    toneMapRGB24(in, out, gamma, gain, bias, op);
+    return;
+  }
+  if(!fusedSupported(radius, type, op)){
+    planarImage temp;
+    planarImage* filtered = (scratch != NULL) ? scratch : &temp;
+    convolution(in, *filtered, radius, type);
+    toneMapRGB24(*filtered, out, gamma, gain, bias, op);
+    return;
+  }
+  static profileStage* stage = profileStageFor("convolveToneMapRGB24");
+  scopedTimer timer(stage, (long long)width * height);
+  int size = 2 * radius + 1;
+  //sharpen is size^2 times the centre pixel minus the sum over the window
+  bool sharpen = !isSeparable(type);
+  float centre = (float)(size * size);
+  std::vector<float> vertical, horizontal;
+  if(sharpen){
+    vertical.assign(size, 1.0f);
+    horizontal.assign(size, -1.0f);
+  } else {
+    buildKernel1D(radius, type, vertical);
+    horizontal = vertical;
+  }
+  //entry x + radius holds the reflected index of column x
+  std::vector<int> idx(width + 2 * radius + 1);
+  for(int i = 0; i < (int)idx.size(); i++){
+    idx[i] = reflectIndex(i - radius, width);
+  }
+  const fixedKernel& fixed = fixedKernelFor(radius);
+  std::shared_ptr<const toneCurve> curve = toneCurveFor(op, gamma, gain, bias);
+  int bands = (height + FUSED_ROWS - 1) / FUSED_ROWS;
+  int tiles = (width + FUSED_COLUMNS - 1) / FUSED_COLUMNS;
+  sharedPool()->parallelFor(bands * tiles, [&](int t){
+    int y0 = (t / tiles) * FUSED_ROWS, y1 = std::min(height, y0 + FUSED_ROWS);
+    int x0 = (t % tiles) * FUSED_COLUMNS, x1 = std::min(width, x0 + FUSED_COLUMNS);
+    int count = x1 - x0, span = alignedSpan(count);
+    //columns the vertical pass covers; s0 starts on a block so whole block loads stay inside the source rows
+    int s0 = std::max(0, x0 - radius) / PLANE_ALIGN * PLANE_ALIGN;
+    int s1 = std::min(width, x1 + radius);
+    //vertical pass output, with room for the reflected columns either side; column x is at radius + x - s0
+    std::vector<float> column(radius + std::max(alignedSpan(s1 - s0), x0 - s0 + span + radius), 0.0f);
+    std::vector<float> filtered(3 * span);
+    const float* taps = &column[x0 - s0];
+    const float* rows[2 * FIXED_RADIUS_MAX + 1];
+    for(int y = y0; y < y1; y++){
+      for(int c = 0; c < 3; c++){
+        for(int k = 0; k < size; k++){
+          rows[k] = in.returnRow(c, reflectIndex(y + k - radius, height)) + s0;
+        }
+        fixed.vertical(rows, &column[radius], &vertical[0], alignedSpan(s1 - s0));
+        //only tiles at the image edges need reflected columns
+        for(int x = x0 - radius; x < 0; x++){
+          column[radius + x - s0] = column[radius + idx[x + radius] - s0];
+        }
+        for(int x = width; x < x1 + radius; x++){
+          column[radius + x - s0] = column[radius + idx[x + radius] - s0];
+        }
+        float* dst = &filtered[c * span];
+        fixed.horizontal(&taps, dst, &horizontal[0], span);
+        if(sharpen) accumulateSpan(dst, in.returnRow(c, y) + x0, centre, count);
+      }
+      //the row is still in L1, so it goes to the tone mapper before anything else touches memory
+      toneMapRowRGB24(*curve, &filtered[0], &filtered[span], &filtered[2 * span], out + 3 * ((size_t)width * y + x0), count);
+    }
+  });
+}
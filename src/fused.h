@@ -0,0 +1,47 @@
+#ifndef FUSED_H
+#define FUSED_H
+
+#include "image.h"
+#include "tonemap.h"
+
+//rows and columns of output each worker produces at a time
+#define FUSED_ROWS 16
+#define FUSED_COLUMNS 1024
+
+//
+// Convolution, tone mapping and the pack into RGB24 in a single pass, for
+// the small kernels where the staged pipeline (convolution() into a float
+// image, then toneMapRGB24() reading it back) is bound by memory bandwidth
+// rather than arithmetic. Output is produced a row of a FUSED_COLUMNS wide
+// tile at a time: the vertical pass sums the 2 * radius + 1 source rows it
+// needs into one row buffer, the horizontal pass runs over that buffer (both
+// with the taps compiled for the radius, see kernels.h), and the three
+// filtered channels are tone mapped straight into out, so the filtered image
+// never exists in full and every output byte is written once. The sharpen
+// kernel is run as the centre tap minus a box sum, which makes it
+// separable too. Tiles don't depend on the thread count, so neither do the
+// results. Box and gaussian results match the staged pipeline to within one
+// step of the 8 bit output. Sharpen results sit near zero luminance, where
+// the tone curve magnifies the rounding in any order of summation, so a few
+// of its pixels can differ by more.
+//
+// Cases fusedSupported() rejects (the bilateral filter, radii past
+// FIXED_RADIUS_MAX, which convolution() may hand to the FFT or running sums,
+// and TONE_LOCAL, which needs the whole filtered image) run the staged
+// pipeline through scratch instead.
+//
+// \param in planar RGB source
+// \param out interleaved RGB24 output, 3 * width * height bytes
+// \param radius kernel radius in pixels (below 1, or type KERNEL_NONE, tone maps in directly)
+// \param type KERNEL_BOX, KERNEL_GAUSSIAN, KERNEL_BILATERAL, or anything else for sharpen
+// \param gamma, gain, bias, op as for toneMapRGB24
+// \param scratch optional image for the filtered result when falling back;
+//        allocated per call when NULL
+//
+void convolveToneMapRGB24(const planarImage& in, unsigned char* out, int radius, int type, float gamma, float gain, float bias,
+                          int op = TONE_POWER, planarImage* scratch = NULL);
+
+//true when convolveToneMapRGB24 runs this kernel and operator as one pass
+bool fusedSupported(int radius, int type, int op);
+
+#endif
@@ -0,0 +1,205 @@
+#include "graph.h"
+#include "filter.h"
+#include "tonemap.h"
+#include "fused.h"
+
+processingGraph::processingGraph(frameBuffers* buffers){
+  this->buffers = buffers;
+  this->sourceVersion = 0;
+  this->filterOn = false;
+  this->radius = 1;
+  this->type = KERNEL_BOX;
+  this->useClock = 0;
+  this->filterCache.reserve(FILTER_CACHE_SIZE);
+  this->filtered = NULL;
+  this->filterValid = false;
+  this->filteredRadius = 0;
+  this->filteredType = 0;
+  this->filteredOn = false;
+  this->filteredSource = 0;
+  this->filterVersion = 0;
+  this->gamma = 1.0f;
+  this->gain = 1.0f;
+  this->bias = 1.0f;
+  this->op = TONE_POWER;
+  this->autoExposure = false;
+  this->statsValid = false;
+  this->statsFilterVersion = 0;
+  this->toneValid = false;
+  this->tonedOp = TONE_POWER;
+  this->tonedGamma = 0.0f;
+  this->tonedGain = 0.0f;
+  this->tonedBias = 0.0f;
+  this->tonedFilterVersion = 0;
+  this->fused = false;
+  this->fusedValid = false;
+  this->fusedSource = 0;
+  this->fusedRadius = 0;
+  this->fusedType = 0;
+  this->displayVersion = 0;
+  this->active = false;
+  this->filterRuns = 0;
+  this->filterHits = 0;
+  this->toneRuns = 0;
+  this->fusedRuns = 0;
+}
+
+void processingGraph::setSource(){
+  //cached results for the old source are dropped lazily by the version check
+  this->sourceVersion++;
+}
+
+void processingGraph::setFilter(int radius, int type){
+  this->active = true;
+  this->filterOn = true;
+  this->radius = radius;
+  this->type = type;
+}
+
+void processingGraph::clearFilter(){
+  this->filterOn = false;
+}
+
+void processingGraph::setTone(float gamma, float gain, float bias){
+  this->active = true;
+  this->gamma = gamma;
+  this->gain = gain;
+  this->bias = bias;
+}
+
+void processingGraph::setToneOperator(int op, bool autoExposure){
+  this->active = true;
+  this->op = op;
+  this->autoExposure = autoExposure;
+}
+
+void processingGraph::setFused(bool fused){
+  this->fused = fused;
+}
+
+bool processingGraph::evaluateFused(){
+  if(this->fusedValid && this->fusedSource == this->sourceVersion && this->fusedRadius == this->radius && this->fusedType == this->type &&
+     this->tonedOp == this->op && this->tonedGamma == this->gamma && this->tonedGain == this->gain && this->tonedBias == this->bias){
+    return false;
+  }
+  convolveToneMapRGB24(*this->buffers->returnSource(), this->buffers->returnDisplay(), this->radius, this->type,
+                       this->gamma, this->gain, this->bias, this->op);
+  this->fusedValid = true;
+  this->fusedSource = this->sourceVersion;
+  this->fusedRadius = this->radius;
+  this->fusedType = this->type;
+  //the staged stages' output is no longer what is on display
+  this->toneValid = false;
+  this->tonedOp = this->op;
+  this->tonedGamma = this->gamma;
+  this->tonedGain = this->gain;
+  this->tonedBias = this->bias;
+  this->displayVersion++;
+  this->fusedRuns++;
+  return true;
+}
+
+void processingGraph::evaluateFilter(){
+  //nothing upstream changed since the last run
+  if(this->filterValid && this->filteredOn == this->filterOn && this->filteredSource == this->sourceVersion &&
+     (!this->filterOn || (this->filteredRadius == this->radius && this->filteredType == this->type))){
+    return;
+  }
+  this->filterValid = true;
+  this->filteredOn = this->filterOn;
+  this->filteredSource = this->sourceVersion;
+  this->filteredRadius = this->radius;
+  this->filteredType = this->type;
+  this->filterVersion++;
+  if(!this->filterOn){
+    this->filtered = this->buffers->returnSource();
+    return;
+  }
+  this->useClock++;
+  //reuse a cached result for this radius and type if there is one
+  for(size_t i = 0; i < this->filterCache.size(); i++){
+    filterEntry& entry = this->filterCache[i];
+    if(entry.radius == this->radius && entry.type == this->type && entry.sourceVersion == this->sourceVersion){
+      entry.lastUse = this->useClock;
+      this->filtered = &entry.data;
+      this->filterHits++;
+      return;
+    }
+  }
+  //otherwise fill an empty slot, or overwrite the least recently used one
+  size_t slot = this->filterCache.size();
+  if(slot < FILTER_CACHE_SIZE){
+    this->filterCache.push_back(filterEntry());
+  } else {
+    slot = 0;
+    for(size_t i = 1; i < this->filterCache.size(); i++){
+      if(this->filterCache[i].lastUse < this->filterCache[slot].lastUse) slot = i;
+    }
+  }
+  filterEntry& entry = this->filterCache[slot];
+  entry.radius = this->radius;
+  entry.type = this->type;
+  entry.sourceVersion = this->sourceVersion;
+  entry.lastUse = this->useClock;
+  convolution(*this->buffers->returnSource(), entry.data, this->radius, this->type, this->buffers->returnScratch());
+  this->filtered = &entry.data;
+  this->filterRuns++;
+}
+
+bool processingGraph::evaluate(){
+  if(!this->active) return false;
+  //auto exposure needs the filtered image to measure, so it always runs staged
+  if(this->fused && this->filterOn && !this->autoExposure && fusedSupported(this->radius, this->type, this->op)){
+    return evaluateFused();
+  }
+  evaluateFilter();
+  float gain = this->gain, bias = this->bias;
+  if(this->autoExposure){
+    if(!this->statsValid || this->statsFilterVersion != this->filterVersion){
+      measureTone(*this->filtered, this->stats);
+      this->statsValid = true;
+      this->statsFilterVersion = this->filterVersion;
+    }
+    ::autoExposure(this->stats, this->op, this->gamma, gain, bias);
+  }
+  if(this->toneValid && this->tonedFilterVersion == this->filterVersion && this->tonedOp == this->op &&
+     this->tonedGamma == this->gamma && this->tonedGain == gain && this->tonedBias == bias){
+    return false;
+  }
+  toneMapRGB24(*this->filtered, this->buffers->returnDisplay(), this->gamma, gain, bias, this->op);
+  this->toneValid = true;
+  this->fusedValid = false;
+  this->tonedFilterVersion = this->filterVersion;
+  this->tonedOp = this->op;
+  this->tonedGamma = this->gamma;
+  this->tonedGain = gain;
+  this->tonedBias = bias;
+  this->displayVersion++;
+  this->toneRuns++;
+  return true;
+}
+
+const planarImage* processingGraph::returnFiltered(){
+  evaluateFilter();
+  return this->filtered;
+}
+
+unsigned processingGraph::returnVersion(){
+  return this->displayVersion;
+}
+
+int processingGraph::returnFilterRuns(){
+  return this->filterRuns;
+}
+
+int processingGraph::returnFilterHits(){
+  return this->filterHits;
+}
+
+int processingGraph::returnToneRuns(){
+  return this->toneRuns;
+}
+
+int processingGraph::returnFusedRuns(){
+  return this->fusedRuns;
+}
@@ -0,0 +1,106 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "framebuffer.h"
+#include "tonemap.h"
+
+#include <vector>
+
+//filtered images kept around so toggling back to a recent kernel is free
+#define FILTER_CACHE_SIZE 4
+
+//
+// The viewer's pipeline as a chain of cached stages:
+//   load (frameBuffers source) -> convolve -> tone map + quantize (fused,
+//   into the frameBuffers display frame) -> upload (done by the caller
+//   whenever returnVersion() changes).
+// Setters only record parameters; evaluate() reruns just the stages whose
+// inputs changed since their output was made. Convolution results are kept
+// for the last FILTER_CACHE_SIZE radius/type pairs. Under auto exposure the
+// tone map stage measures the filtered image (see measureTone) and keeps the
+// statistics until the filter output changes. In fused mode, kernels that
+// convolveToneMapRGB24 can run in one pass skip the convolve stage and its
+// cache and go from the source straight to the display frame; that saves the
+// round trip through a filtered image on every edit, but tone-only edits then
+// convolve again.
+//
+class processingGraph {
+  private:
+    struct filterEntry {
+      int radius;
+      int type;
+      unsigned sourceVersion;
+      unsigned lastUse;
+      planarImage data;
+    };
+    frameBuffers* buffers;
+    unsigned sourceVersion;
+    //convolve stage
+    bool filterOn;
+    int radius;
+    int type;
+    std::vector<filterEntry> filterCache;
+    unsigned useClock;
+    const planarImage* filtered;
+    bool filterValid;
+    int filteredRadius;
+    int filteredType;
+    bool filteredOn;
+    unsigned filteredSource;
+    unsigned filterVersion;
+    //tone map stage
+    float gamma;
+    float gain;
+    float bias;
+    int op;
+    bool autoExposure;
+    toneStats stats;
+    bool statsValid;
+    unsigned statsFilterVersion;
+    bool toneValid;
+    int tonedOp;
+    float tonedGamma;
+    float tonedGain;
+    float tonedBias;
+    unsigned tonedFilterVersion;
+    //fused convolve + tone map stage; shares the toned* settings with the tone map stage
+    bool fused;
+    bool fusedValid;
+    unsigned fusedSource;
+    int fusedRadius;
+    int fusedType;
+    unsigned displayVersion;
+    //false until a filter or tone setting arrives; the display keeps its initial frame until then
+    bool active;
+    //counters reported by the viewer
+    int filterRuns;
+    int filterHits;
+    int toneRuns;
+    int fusedRuns;
+    void evaluateFilter();
+    bool evaluateFused();
+  public:
+    processingGraph(frameBuffers* buffers);
+    //call after new pixels are written to the source buffer
+    void setSource();
+    void setFilter(int radius, int type);
+    //turns the convolve stage off so tone mapping sees the source directly
+    void clearFilter();
+    void setTone(float gamma, float gain, float bias);
+    //picks the tone operator (TONE_POWER and the rest); with autoExposure, gain and bias come from the image instead of setTone
+    void setToneOperator(int op, bool autoExposure);
+    //runs supported kernels as a single convolve + tone map pass (see convolveToneMapRGB24)
+    void setFused(bool fused);
+    //brings the display frame up to date; returns true if it changed (never before the first setter call)
+    bool evaluate();
+    //output of the convolve stage (the source when no filter is set)
+    const planarImage* returnFiltered();
+    //changes every time the display frame is rewritten
+    unsigned returnVersion();
+    int returnFilterRuns();
+    int returnFilterHits();
+    int returnToneRuns();
+    int returnFusedRuns();
+};
+
+#endif
@@ -0,0 +1,327 @@
+#include "hdr.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+//bytes pulled from the file at a time while decoding
+#define HDR_READ_CHUNK 65536
+//shortest run worth encoding as a run
+#define HDR_MIN_RUN 4
+
+hdr::hdr(){
+  this->data = NULL;
+  this->width = 0;
+  this->height = 0;
+  this->exposure = 1.0f;
+  this->bufferPos = 0;
+  this->bufferLen = 0;
+  this->flat = false;
+}
+
+bool isHDRFile(std::string name){
+  std::ifstream input(name, std::ifstream::in | std::ifstream::binary);
+  char magic[2] = {0, 0};
+  input.read(magic, 2);
+  return input.gcount() == 2 && magic[0] == '#' && magic[1] == '?';
+}
+
+//converts one rgbe pixel to floats (same convention as Greg Ward's code)
+static void rgbeToFloat(const unsigned char* rgbe, float* out){
+  if(rgbe[3] == 0){
+    out[0] = out[1] = out[2] = 0.0f;
+    return;
+  }
+  float f = (float)ldexp(1.0, rgbe[3] - (int)(128 + 8));
+  out[0] = rgbe[0] * f;
+  out[1] = rgbe[1] * f;
+  out[2] = rgbe[2] * f;
+}
+
+//converts floats to an rgbe pixel with a shared exponent
+static void floatToRGBE(const float* in, unsigned char* rgbe){
+  float v = in[0];
+  if(in[1] > v) v = in[1];
+  if(in[2] > v) v = in[2];
+  if(v < 1e-32f){
+    rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+    return;
+  }
+  int e;
+  float scale = (float)(frexp(v, &e) * 256.0 / v);
+  rgbe[0] = (unsigned char)(in[0] > 0.0f ? in[0] * scale : 0.0f);
+  rgbe[1] = (unsigned char)(in[1] > 0.0f ? in[1] * scale : 0.0f);
+  rgbe[2] = (unsigned char)(in[2] > 0.0f ? in[2] * scale : 0.0f);
+  rgbe[3] = (unsigned char)(e + 128);
+}
+
+//copies count bytes out of the read buffer, refilling it from the file as needed
+bool hdr::readBytes(unsigned char* dest, size_t count){
+  while(count > 0){
+    if(this->bufferPos == this->bufferLen){
+      this->input.read((char*)&this->buffer[0], this->buffer.size());
+      this->bufferLen = (size_t)this->input.gcount();
+      this->bufferPos = 0;
+      if(this->bufferLen == 0) return false;
+    }
+    size_t n = this->bufferLen - this->bufferPos;
+    if(n > count) n = count;
+    memcpy(dest, &this->buffer[this->bufferPos], n);
+    this->bufferPos = this->bufferPos + n;
+    dest = dest + n;
+    count = count - n;
+  }
+  return true;
+}
+
+bool hdr::readHeader(std::string name){
+  std::string temp;
+  this->input.open(name, std::ifstream::in | std::ifstream::binary);
+  //verifies file existence
+  if(!(this->input.is_open())){
+    std::cout << "File not found; try excluding the filename extension" << std::endl;
+    return false;
+  }
+  //verifies file is of right format
+  getline(this->input, temp);
+  if(temp.compare(0, 2, "#?") != 0){
+    std::cout << "File not correct format" << std::endl;
+    return false;
+  }
+  //header variables run until a blank line
+  this->exposure = 1.0f;
+  while(getline(this->input, temp) && !temp.empty()){
+    if(temp.compare(0, 7, "FORMAT=") == 0 && temp.compare(7, std::string::npos, "32-bit_rle_rgbe") != 0){
+      std::cout << "Unsupported HDR pixel format " << temp.substr(7) << std::endl;
+      return false;
+    }
+    if(temp.compare(0, 9, "EXPOSURE=") == 0){
+      this->exposure = this->exposure * (float)atof(temp.c_str() + 9);
+    }
+  }
+  //only the standard top-to-bottom, left-to-right orientation is supported
+  getline(this->input, temp);
+  if(sscanf(temp.c_str(), "-Y %d +X %d", &this->height, &this->width) != 2 || this->width <= 0 || this->height <= 0){
+    std::cout << "Unsupported HDR resolution line " << temp << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool hdr::beginRead(std::string name){
+  if(!readHeader(name)) return false;
+  this->buffer.resize(HDR_READ_CHUNK);
+  this->bufferPos = 0;
+  this->bufferLen = 0;
+  this->flat = false;
+  this->line.resize(4 * this->width);
+  return true;
+}
+
+bool hdr::readScanline(float* out){
+  unsigned char* rgbe = &this->line[0];
+  int i, c;
+  //widths outside this range can't be run length encoded
+  if(this->flat || this->width < 8 || this->width > 0x7fff){
+    this->flat = true;
+  } else {
+    if(!readBytes(rgbe, 4)){
+      std::cout << "HDR file ended early" << std::endl;
+      return false;
+    }
+    //a scanline that doesn't start with the RLE marker means the rest of the file is flat
+    if(rgbe[0] != 2 || rgbe[1] != 2 || (rgbe[2] & 0x80)){
+      this->flat = true;
+      if(!readBytes(rgbe + 4, 4 * (this->width - 1))){
+        std::cout << "HDR file ended early" << std::endl;
+        return false;
+      }
+      for(i = 0; i < this->width; i++){
+        rgbeToFloat(rgbe + 4 * i, out + 3 * i);
+      }
+      return true;
+    }
+    if(((rgbe[2] << 8) | rgbe[3]) != this->width){
+      std::cout << "HDR scanline width mismatch" << std::endl;
+      return false;
+    }
+    //each component is stored separately as runs and literal spans
+    unsigned char code[2];
+    for(c = 0; c < 4; c++){
+      i = 0;
+      while(i < this->width){
+        if(!readBytes(code, 1)){
+          std::cout << "HDR file ended early" << std::endl;
+          return false;
+        }
+        int count = code[0];
+        bool run = count > 128;
+        if(run) count = count - 128;
+        if(count == 0 || count > this->width - i){
+          std::cout << "Bad HDR scanline data" << std::endl;
+          return false;
+        }
+        if(run){
+          if(!readBytes(code + 1, 1)){
+            std::cout << "HDR file ended early" << std::endl;
+            return false;
+          }
+          for(; count > 0; count--){
+            rgbe[4 * i + c] = code[1];
+            i++;
+          }
+        } else {
+          for(; count > 0; count--){
+            if(!readBytes(rgbe + 4 * i + c, 1)){
+              std::cout << "HDR file ended early" << std::endl;
+              return false;
+            }
+            i++;
+          }
+        }
+      }
+    }
+    for(i = 0; i < this->width; i++){
+      rgbeToFloat(rgbe + 4 * i, out + 3 * i);
+    }
+    return true;
+  }
+  if(!readBytes(rgbe, 4 * this->width)){
+    std::cout << "HDR file ended early" << std::endl;
+    return false;
+  }
+  for(i = 0; i < this->width; i++){
+    rgbeToFloat(rgbe + 4 * i, out + 3 * i);
+  }
+  return true;
+}
+
+void hdr::endRead(){
+  this->input.close();
+  std::vector<unsigned char>().swap(this->buffer);
+}
+
+//loads in image data from filename argument, decoding straight into the float buffer
+void hdr::readData(std::string name){
+  if(!beginRead(name)) exit(EXIT_FAILURE);
+  this->data = new float[3 * this->width * this->height];
+  for(int y = 0; y < this->height; y++){
+    if(!readScanline(this->data + 3 * this->width * y)) exit(EXIT_FAILURE);
+  }
+  endRead();
+}
+
+void hdr::beginWrite(std::string name, int width, int height){
+  this->output.open(name, std::ofstream::out | std::ofstream::binary);
+  if(!(this->output.is_open())){
+    std::cout << "Could not open " << name << " for writing" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  this->width = width;
+  this->height = height;
+  this->output << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " << height << " +X " << width << "\n";
+}
+
+//appends one component of a scanline using Greg Ward's run length scheme
+static void encodeComponent(const unsigned char* rgbe, int width, int c, std::vector<unsigned char>& out){
+  int cur = 0, begRun, runCount, oldRunCount, nonRun;
+  while(cur < width){
+    begRun = cur;
+    runCount = 0;
+    oldRunCount = 0;
+    //find the next run long enough to be worth encoding
+    while(runCount < HDR_MIN_RUN && begRun < width){
+      begRun = begRun + runCount;
+      oldRunCount = runCount;
+      runCount = 1;
+      while(begRun + runCount < width && runCount < 127 && rgbe[4 * begRun + c] == rgbe[4 * (begRun + runCount) + c]){
+        runCount++;
+      }
+    }
+    //a short run right before it still saves a byte
+    if(oldRunCount > 1 && oldRunCount == begRun - cur){
+      out.push_back((unsigned char)(128 + oldRunCount));
+      out.push_back(rgbe[4 * cur + c]);
+      cur = begRun;
+    }
+    //literal bytes up to the start of the run
+    while(cur < begRun){
+      nonRun = begRun - cur;
+      if(nonRun > 128) nonRun = 128;
+      out.push_back((unsigned char)nonRun);
+      for(int i = 0; i < nonRun; i++){
+        out.push_back(rgbe[4 * (cur + i) + c]);
+      }
+      cur = cur + nonRun;
+    }
+    if(runCount >= HDR_MIN_RUN){
+      out.push_back((unsigned char)(128 + runCount));
+      out.push_back(rgbe[4 * begRun + c]);
+      cur = cur + runCount;
+    }
+  }
+}
+
+void hdr::writeScanline(const float* in){
+  //the read buffer holds the unencoded pixels while writing
+  std::vector<unsigned char>& rgbe = this->buffer;
+  rgbe.resize(4 * this->width);
+  for(int i = 0; i < this->width; i++){
+    floatToRGBE(in + 3 * i, &rgbe[4 * i]);
+  }
+  //widths outside this range have to be written flat
+  if(this->width < 8 || this->width > 0x7fff){
+    this->output.write((char*)&rgbe[0], rgbe.size());
+    return;
+  }
+  this->line.clear();
+  this->line.push_back(2);
+  this->line.push_back(2);
+  this->line.push_back((unsigned char)(this->width >> 8));
+  this->line.push_back((unsigned char)(this->width & 0xff));
+  for(int c = 0; c < 4; c++){
+    encodeComponent(&rgbe[0], this->width, c, this->line);
+  }
+  this->output.write((char*)&this->line[0], this->line.size());
+}
+
+void hdr::endWrite(){
+  this->output.close();
+}
+
+//writes the float data out as a run length encoded .hdr
+void hdr::writeData(std::string name){
+  beginWrite(name, this->width, this->height);
+  for(int y = 0; y < this->height; y++){
+    writeScanline(this->data + 3 * this->width * y);
+  }
+  endWrite();
+}
+
+float* hdr::returnData(){
+  return this->data;
+}
+
+int hdr::returnWidth(){
+  return this->width;
+}
+
+int hdr::returnHeight(){
+  return this->height;
+}
+
+float hdr::returnExposure(){
+  return this->exposure;
+}
+
+void hdr::setData(float* data){
+  this->data = data;
+}
+
+void hdr::setWidth(int width){
+  this->width = width;
+}
+
+void hdr::setHeight(int height){
+  this->height = height;
+}
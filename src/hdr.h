@@ -0,0 +1,62 @@
+#ifndef HDR_H
+#define HDR_H
+
+#include <string>
+#include <fstream>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+
+//
+// Radiance RGBE (.hdr) images, decoded to and encoded from interleaved float
+// RGB. Reading and writing both work a scanline at a time, so callers can
+// stream large images into their own storage (beginRead/readScanline) instead
+// of holding the file and the decoded image in memory together. Scanlines use
+// the new-style run length encoding on write; flat and new-style RLE files are
+// read (see rgbe.txt for the format).
+//
+class hdr {
+  private:
+    float* data;
+    int width;
+    int height;
+    float exposure;
+    //buffered input shared by the scanline decoder
+    std::ifstream input;
+    std::vector<unsigned char> buffer;
+    size_t bufferPos;
+    size_t bufferLen;
+    bool flat;
+    //encoded bytes for the scanline being read or written
+    std::vector<unsigned char> line;
+    std::ofstream output;
+    bool readBytes(unsigned char* dest, size_t count);
+    bool readHeader(std::string name);
+  public:
+    hdr();
+    void readData(std::string name);
+    void writeData(std::string name);
+    //opens name and parses its header; width and height are valid afterwards. false, after printing why, if it can't
+    bool beginRead(std::string name);
+    //decodes the next scanline into 3 * width floats; false, after printing why, if the file is bad or ends early
+    bool readScanline(float* out);
+    void endRead();
+    //writes the header for a width x height image
+    void beginWrite(std::string name, int width, int height);
+    //run length encodes 3 * width floats as the next scanline
+    void writeScanline(const float* in);
+    void endWrite();
+    float* returnData();
+    int returnWidth();
+    int returnHeight();
+    //EXPOSURE from the header (1 when absent); pixel values are left as stored
+    float returnExposure();
+    void setData(float* data);
+    void setWidth(int width);
+    void setHeight(int height);
+};
+
+//true if the file starts with the Radiance "#?" signature
+bool isHDRFile(std::string name);
+
+#endif
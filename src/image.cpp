@@ -0,0 +1,201 @@
+#include "image.h"
+#include "threadpool.h"
+#include "profile.h"
+
+#include <cstring>
+#include <utility>
+
+//planes start on their own cache line
+#define IMAGE_ALIGN 64
+
+planarImage::planarImage(){
+  this->block = NULL;
+  this->capacity = 0;
+  this->planes = NULL;
+  this->width = 0;
+  this->height = 0;
+  this->pitch = 0;
+  this->eightBit = false;
+}
+
+planarImage::~planarImage(){
+  delete[] this->block;
+}
+
+planarImage::planarImage(const planarImage& other){
+  this->block = NULL;
+  this->capacity = 0;
+  this->planes = NULL;
+  this->width = 0;
+  this->height = 0;
+  this->pitch = 0;
+  this->eightBit = false;
+  *this = other;
+}
+
+planarImage& planarImage::operator=(const planarImage& other){
+  if(this == &other) return *this;
+  resize(other.width, other.height);
+  if(this->planes != NULL && other.planes != NULL){
+    memcpy(this->planes, other.planes, 3 * (size_t)this->pitch * this->height * sizeof(float));
+  }
+  this->eightBit = other.eightBit;
+  return *this;
+}
+
+planarImage::planarImage(planarImage&& other) noexcept {
+  this->block = NULL;
+  this->capacity = 0;
+  this->planes = NULL;
+  this->width = 0;
+  this->height = 0;
+  this->pitch = 0;
+  this->eightBit = false;
+  *this = std::move(other);
+}
+
+planarImage& planarImage::operator=(planarImage&& other) noexcept {
+  if(this == &other) return *this;
+  delete[] this->block;
+  this->block = other.block;
+  this->capacity = other.capacity;
+  this->planes = other.planes;
+  this->width = other.width;
+  this->height = other.height;
+  this->pitch = other.pitch;
+  this->eightBit = other.eightBit;
+  other.block = NULL;
+  other.capacity = 0;
+  other.planes = NULL;
+  other.width = 0;
+  other.height = 0;
+  other.pitch = 0;
+  other.eightBit = false;
+  return *this;
+}
+
+void planarImage::resize(int width, int height){
+  int pitch = (width + PLANE_ALIGN - 1) / PLANE_ALIGN * PLANE_ALIGN;
+  size_t needed = 3 * (size_t)pitch * height * sizeof(float);
+  if(needed > this->capacity){
+    delete[] this->block;
+    //extra room so the planes can be aligned
+    this->block = new unsigned char[needed + IMAGE_ALIGN];
+    this->capacity = needed;
+    profileAllocation(needed + IMAGE_ALIGN);
+  }
+  if(this->block != NULL){
+    size_t offset = (IMAGE_ALIGN - (size_t)this->block % IMAGE_ALIGN) % IMAGE_ALIGN;
+    this->planes = (float*)(this->block + offset);
+  }
+  this->width = width;
+  this->height = height;
+  this->pitch = pitch;
+  this->eightBit = false;
+  //kernels work in whole blocks, so the padding has to hold real numbers
+  if(pitch > width){
+    for(int c = 0; c < 3; c++){
+      for(int y = 0; y < height; y++){
+        float* row = returnRow(c, y);
+        for(int x = width; x < pitch; x++){
+          row[x] = 0.0f;
+        }
+      }
+    }
+  }
+}
+
+float* planarImage::returnPlane(int channel){
+  return this->planes + (size_t)channel * this->pitch * this->height;
+}
+
+const float* planarImage::returnPlane(int channel) const {
+  return this->planes + (size_t)channel * this->pitch * this->height;
+}
+
+float* planarImage::returnRow(int channel, int y){
+  return returnPlane(channel) + (size_t)this->pitch * y;
+}
+
+const float* planarImage::returnRow(int channel, int y) const {
+  return returnPlane(channel) + (size_t)this->pitch * y;
+}
+
+int planarImage::returnWidth() const {
+  return this->width;
+}
+
+int planarImage::returnHeight() const {
+  return this->height;
+}
+
+int planarImage::returnPitch() const {
+  return this->pitch;
+}
+
+bool planarImage::returnEightBit() const {
+  return this->eightBit;
+}
+
+void planarImage::fromRGB24(const unsigned char* rgb, int width, int height){
+  resize(width, height);
+  sharedPool()->parallelFor(height, [&](int y){
+    const unsigned char* src = rgb + 3 * (size_t)width * y;
+    float* r = returnRow(0, y);
+    float* g = returnRow(1, y);
+    float* b = returnRow(2, y);
+    for(int x = 0; x < width; x++){
+      r[x] = src[3 * x];
+      g[x] = src[3 * x + 1];
+      b[x] = src[3 * x + 2];
+    }
+  });
+  this->eightBit = true;
+}
+
+void planarImage::setRow(int y, const float* rgb, float scale){
+  this->eightBit = false;
+  float* r = returnRow(0, y);
+  float* g = returnRow(1, y);
+  float* b = returnRow(2, y);
+  for(int x = 0; x < this->width; x++){
+    r[x] = rgb[3 * x] * scale;
+    g[x] = rgb[3 * x + 1] * scale;
+    b[x] = rgb[3 * x + 2] * scale;
+  }
+}
+
+//clamps to [0, 255] (NaN goes to 0) and rounds half up
+static inline unsigned char quantize(float v){
+  if(!(v > 0.0f)) return 0;
+  if(v > 255.0f) return 255;
+  return (unsigned char)(int)(v + 0.5f);
+}
+
+void planarImage::toRGB24(unsigned char* rgb) const {
+  sharedPool()->parallelFor(this->height, [&](int y){
+    unsigned char* dst = rgb + 3 * (size_t)this->width * y;
+    const float* r = returnRow(0, y);
+    const float* g = returnRow(1, y);
+    const float* b = returnRow(2, y);
+    for(int x = 0; x < this->width; x++){
+      dst[3 * x] = quantize(r[x]);
+      dst[3 * x + 1] = quantize(g[x]);
+      dst[3 * x + 2] = quantize(b[x]);
+    }
+  });
+}
+
+void planarImage::toRGB(float* rgb) const {
+  sharedPool()->parallelFor(this->height, [&](int y){
+    float* dst = rgb + 3 * (size_t)this->width * y;
+    const float* r = returnRow(0, y);
+    const float* g = returnRow(1, y);
+    const float* b = returnRow(2, y);
+    for(int x = 0; x < this->width; x++){
+      dst[3 * x] = r[x];
+      dst[3 * x + 1] = g[x];
+      dst[3 * x + 2] = b[x];
+    }
+  });
+}
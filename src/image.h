@@ -0,0 +1,78 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <cstddef>
+
+//rows are padded to a multiple of this many floats (64 bytes), so every row of every plane starts on a cache line
+#define PLANE_ALIGN 16
+
+//
+// Float RGB image stored as three separate planes (red, then green, then
+// blue) in one aligned allocation. Each plane is height rows of returnPitch()
+// floats. Keeping the channels apart lets every stage run one stride-1 loop
+// per channel that the compiler can vectorize, instead of striding by 3
+// through interleaved RGB. Kernels may run those loops over whole
+// PLANE_ALIGN blocks and so read and write the padding past width; resize()
+// zeroes it so it always holds finite values. The 8 bit interleaved layout
+// ppm and SDL's RGB24 textures use is only produced at the edges, through
+// the conversions below or toneMapRGB24().
+//
+class planarImage {
+  private:
+    unsigned char* block;
+    size_t capacity;
+    float* planes;
+    int width;
+    int height;
+    int pitch;
+    bool eightBit;
+  public:
+    planarImage();
+    ~planarImage();
+    //copies are deep, so images can live in standard containers
+    planarImage(const planarImage& other);
+    planarImage& operator=(const planarImage& other);
+    //moves hand the allocation over without copying
+    planarImage(planarImage&& other) noexcept;
+    planarImage& operator=(planarImage&& other) noexcept;
+    //makes room for a width x height image, keeping the old allocation if it is big enough
+    void resize(int width, int height);
+    //first row of channel (0 red, 1 green, 2 blue); rows follow every returnPitch() floats
+    float* returnPlane(int channel);
+    const float* returnPlane(int channel) const;
+    float* returnRow(int channel, int y);
+    const float* returnRow(int channel, int y) const;
+    int returnWidth() const;
+    int returnHeight() const;
+    int returnPitch() const;
+    //true while every sample is a whole number in [0, 255]; set by fromRGB24, cleared by resize and setRow
+    bool returnEightBit() const;
+    //resizes to width x height and splits interleaved 8 bit RGB into the planes
+    void fromRGB24(const unsigned char* rgb, int width, int height);
+    //splits one row of interleaved float RGB into row y, multiplied by scale
+    void setRow(int y, const float* rgb, float scale);
+    //interleaves the planes into 8 bit RGB, clamped to [0, 255] and rounded (no tone curve)
+    void toRGB24(unsigned char* rgb) const;
+    //interleaves the planes into float RGB
+    void toRGB(float* rgb) const;
+};
+
+//rounds a count of floats up to whole PLANE_ALIGN blocks
+inline int alignedSpan(int count){
+  return (count + PLANE_ALIGN - 1) / PLANE_ALIGN * PLANE_ALIGN;
+}
+
+//
+// dst[x] += w * src[x] for x in [0, alignedSpan(count)). The fixed length
+// inner loop and the restrict qualifiers are what let the compiler vectorize
+// it at -O2, so both spans must have room for the rounded up count.
+//
+inline void accumulateSpan(float* __restrict dst, const float* __restrict src, float w, int count){
+  for(int x = 0; x < count; x += PLANE_ALIGN){
+    for(int k = 0; k < PLANE_ALIGN; k++){
+      dst[x + k] = dst[x + k] + w * src[x + k];
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,267 @@
+#include "imagecache.h"
+#include "ppm.h"
+#include "hdr.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+bool decodeImage(const std::string& name, planarImage& out){
+  static profileStage* stage = profileStageFor("decode");
+  scopedTimer timer(stage);
+  if(isHDRFile(name)){
+    //a scanline at a time straight into the planes
+    hdr radiance;
+    if(!radiance.beginRead(name)) return false;
+    int width = radiance.returnWidth(), height = radiance.returnHeight();
+    std::vector<float> row(3 * width);
+    out.resize(width, height);
+    for(int y = 0; y < height; y++){
+      if(!radiance.readScanline(&row[0])) return false;
+      out.setRow(y, &row[0], 255.0f);
+    }
+    radiance.endRead();
+  } else {
+    //the pixels are only read through the mapping
+    ppm file;
+    if(!file.mapData(name)) return false;
+    int width = file.returnWidth(), height = file.returnHeight();
+    if(file.returnEightBit()){
+      out.fromRGB24(file.returnView(), width, height);
+    } else {
+      //16 bit, ASCII and PFM pixels go in as floats, so nothing is quantized to 8 bits on the way
+      std::vector<float> row(3 * width);
+      out.resize(width, height);
+      for(int y = 0; y < height; y++){
+        file.readRow(y, &row[0]);
+        out.setRow(y, &row[0], 255.0f);
+      }
+    }
+  }
+  timer.setPixels((long long)out.returnWidth() * out.returnHeight());
+  return true;
+}
+
+bool inputsReadable(const std::vector<std::string>& names){
+  bool readable = true;
+  for(size_t i = 0; i < names.size(); i++){
+    std::ifstream file(names[i].c_str(), std::ifstream::in | std::ifstream::binary);
+    if(!file){
+      std::cout << "Can't open input " << names[i] << std::endl;
+      readable = false;
+    }
+  }
+  return readable;
+}
+
+//true if a frame made with a would look the same as one made with b
+static bool sameSettings(const renderParams& a, const renderParams& b){
+  if(a.toneSet != b.toneSet || a.filterSet != b.filterSet) return false;
+  if(a.toneSet && (a.gamma != b.gamma || a.gain != b.gain || a.bias != b.bias)) return false;
+  if(a.toneSet && (a.op != b.op || a.autoExposure != b.autoExposure)) return false;
+  if(a.filterSet && (a.radius != b.radius || a.type != b.type)) return false;
+  return true;
+}
+
+imageCache::imageCache(const std::vector<std::string>& names, size_t budget){
+  this->entries.resize(names.size());
+  for(size_t i = 0; i < names.size(); i++){
+    this->entries[i].name = names[i];
+    this->entries[i].loading = false;
+    this->entries[i].failed = false;
+    this->entries[i].outputWidth = 0;
+    this->entries[i].outputHeight = 0;
+    this->entries[i].lastUse = 0;
+  }
+  this->budget = budget;
+  this->used = 0;
+  this->useClock = 0;
+  this->pinned = -1;
+  this->stop = false;
+  this->hits = 0;
+  this->misses = 0;
+  this->outputHits = 0;
+  this->outputMisses = 0;
+  this->evictions = 0;
+  for(int i = 0; i < IMAGE_CACHE_LOADERS; i++){
+    this->loaders.push_back(std::thread(&imageCache::loaderLoop, this));
+  }
+}
+
+imageCache::~imageCache(){
+  {
+    std::unique_lock<std::mutex> guard(this->lock);
+    this->stop = true;
+  }
+  this->queued.notify_all();
+  for(size_t i = 0; i < this->loaders.size(); i++){
+    this->loaders[i].join();
+  }
+}
+
+static size_t sourceBytes(const planarImage& image){
+  return 3 * sizeof(float) * (size_t)image.returnPitch() * image.returnHeight();
+}
+
+size_t imageCache::entryBytes(const entry& e){
+  size_t bytes = 0;
+  if(e.source) bytes = bytes + sourceBytes(*e.source);
+  if(e.output) bytes = bytes + e.output->size();
+  return bytes;
+}
+
+void imageCache::evict(){
+  while(this->used > this->budget){
+    //least recently used image holding anything, other than the one on screen
+    int victim = -1;
+    for(int i = 0; i < (int)this->entries.size(); i++){
+      const entry& e = this->entries[i];
+      if(i == this->pinned || (!e.source && !e.output)) continue;
+      if(victim < 0 || e.lastUse < this->entries[victim].lastUse) victim = i;
+    }
+    if(victim < 0) return;
+    entry& e = this->entries[victim];
+    this->used = this->used - entryBytes(e);
+    //anyone still using them keeps their own reference
+    e.source.reset();
+    e.output.reset();
+    this->evictions++;
+  }
+}
+
+void imageCache::load(int i, std::unique_lock<std::mutex>& guard){
+  this->entries[i].loading = true;
+  std::string name = this->entries[i].name;
+  guard.unlock();
+  std::shared_ptr<planarImage> image(new planarImage());
+  bool decoded = decodeImage(name, *image);
+  guard.lock();
+  entry& e = this->entries[i];
+  e.loading = false;
+  if(!decoded){
+    //never tried again; acquire() hands back NULL and prefetch() skips it
+    std::cout << "Can't decode " << name << ", skipping it" << std::endl;
+    e.failed = true;
+    this->decoded.notify_all();
+    return;
+  }
+  e.source = image;
+  //counts as a use, so a fresh prefetch isn't the first thing evicted
+  e.lastUse = ++this->useClock;
+  this->used = this->used + sourceBytes(*image);
+  evict();
+  this->decoded.notify_all();
+}
+
+void imageCache::loaderLoop(){
+  std::unique_lock<std::mutex> guard(this->lock);
+  while(true){
+    while(this->queue.empty() && !this->stop){
+      this->queued.wait(guard);
+    }
+    if(this->stop) return;
+    int i = this->queue.front();
+    this->queue.pop_front();
+    //acquire() may have got to it first
+    if(this->entries[i].source || this->entries[i].loading || this->entries[i].failed) continue;
+    load(i, guard);
+  }
+}
+
+int imageCache::returnCount(){
+  return (int)this->entries.size();
+}
+
+std::string imageCache::returnName(int i){
+  std::unique_lock<std::mutex> guard(this->lock);
+  return this->entries[i].name;
+}
+
+std::shared_ptr<const planarImage> imageCache::acquire(int i){
+  std::unique_lock<std::mutex> guard(this->lock);
+  entry& e = this->entries[i];
+  if(e.failed) return e.source;
+  this->pinned = i;
+  e.lastUse = ++this->useClock;
+  if(e.source){
+    this->hits++;
+    return e.source;
+  }
+  this->misses++;
+  if(e.loading){
+    while(e.loading){
+      this->decoded.wait(guard);
+    }
+  } else {
+    load(i, guard);
+  }
+  //evicted again before this thread woke up (only possible with a tiny budget)
+  if(!e.source && !e.failed) load(i, guard);
+  return e.source;
+}
+
+void imageCache::prefetch(int i){
+  {
+    std::unique_lock<std::mutex> guard(this->lock);
+    const entry& e = this->entries[i];
+    if(e.source || e.loading || e.failed) return;
+    if(std::find(this->queue.begin(), this->queue.end(), i) != this->queue.end()) return;
+    //the nearest neighbours were asked for first, so they are decoded first
+    this->queue.push_back(i);
+  }
+  this->queued.notify_one();
+}
+
+void imageCache::storeOutput(int i, const unsigned char* pixels, int width, int height, const renderParams& params){
+  std::shared_ptr<std::vector<unsigned char> > frame(new std::vector<unsigned char>(pixels, pixels + 3 * (size_t)width * height));
+  std::unique_lock<std::mutex> guard(this->lock);
+  entry& e = this->entries[i];
+  if(e.output) this->used = this->used - e.output->size();
+  e.output = frame;
+  e.outputWidth = width;
+  e.outputHeight = height;
+  e.outputParams = params;
+  e.lastUse = ++this->useClock;
+  this->used = this->used + frame->size();
+  evict();
+}
+
+std::shared_ptr<const std::vector<unsigned char> > imageCache::findOutput(int i, const renderParams& params, int& width, int& height){
+  std::unique_lock<std::mutex> guard(this->lock);
+  entry& e = this->entries[i];
+  if(!e.output || !sameSettings(e.outputParams, params)){
+    this->outputMisses++;
+    return std::shared_ptr<const std::vector<unsigned char> >();
+  }
+  this->outputHits++;
+  e.lastUse = ++this->useClock;
+  width = e.outputWidth;
+  height = e.outputHeight;
+  return e.output;
+}
+
+long long imageCache::returnHits(){
+  std::unique_lock<std::mutex> guard(this->lock);
+  return this->hits;
+}
+
+long long imageCache::returnMisses(){
+  std::unique_lock<std::mutex> guard(this->lock);
+  return this->misses;
+}
+
+long long imageCache::returnOutputHits(){
+  std::unique_lock<std::mutex> guard(this->lock);
+  return this->outputHits;
+}
+
+long long imageCache::returnOutputMisses(){
+  std::unique_lock<std::mutex> guard(this->lock);
+  return this->outputMisses;
+}
+
+long long imageCache::returnEvictions(){
+  std::unique_lock<std::mutex> guard(this->lock);
+  return this->evictions;
+}
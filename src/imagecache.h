@@ -0,0 +1,105 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include "image.h"
+#include "render.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//memory the viewer's cache may hold by default, in megabytes (-cache overrides it)
+#define IMAGE_CACHE_BUDGET_MB 1024
+//threads decoding prefetched images
+#define IMAGE_CACHE_LOADERS 2
+//images on each side of the current one that are decoded ahead of time
+#define IMAGE_PREFETCH 2
+
+//
+// Decodes a ppm (P6 or P3, 8 or 16 bit), PFM or Radiance .hdr file into
+// out, in the 0-255 units the filters and tone mapper work in (maxVal, or a
+// radiance of 1, maps to 255). Only 8 bit P6 sources are marked eight bit.
+//
+// \param name file to read
+// \param out image to fill
+// \return false, after printing why, if name can't be read or isn't an image
+//
+bool decodeImage(const std::string& name, planarImage& out);
+
+//true if every name can be opened for reading; prints each one that can't
+bool inputsReadable(const std::vector<std::string>& names);
+
+//
+// Decoded sources and the latest processed frame of each of the viewer's
+// inputs, held within a byte budget. When adding something takes the cache
+// over budget, the least recently used images are dropped (source and output
+// together), except for the one most recently acquired. Prefetched images are
+// decoded on background threads, so stepping to a neighbour usually finds its
+// source ready. Every method is thread safe.
+//
+class imageCache {
+  private:
+    struct entry {
+      std::string name;
+      std::shared_ptr<const planarImage> source;
+      //set while a loader (or acquire) is decoding the image
+      bool loading;
+      //set once decoding has failed
+      bool failed;
+      std::shared_ptr<const std::vector<unsigned char> > output;
+      int outputWidth;
+      int outputHeight;
+      renderParams outputParams;
+      unsigned lastUse;
+    };
+    std::vector<entry> entries;
+    size_t budget;
+    size_t used;
+    unsigned useClock;
+    //index never evicted: the image on screen
+    int pinned;
+    std::mutex lock;
+    std::condition_variable decoded;
+    std::condition_variable queued;
+    std::deque<int> queue;
+    std::vector<std::thread> loaders;
+    bool stop;
+    long long hits;
+    long long misses;
+    long long outputHits;
+    long long outputMisses;
+    long long evictions;
+    void loaderLoop();
+    //decodes entry i outside the lock and stores it; the lock must be held on entry and is held on return
+    void load(int i, std::unique_lock<std::mutex>& guard);
+    size_t entryBytes(const entry& e);
+    void evict();
+  public:
+    //names are the inputs in navigation order; budget is in bytes
+    imageCache(const std::vector<std::string>& names, size_t budget);
+    ~imageCache();
+    imageCache(const imageCache&) = delete;
+    imageCache& operator=(const imageCache&) = delete;
+    int returnCount();
+    std::string returnName(int i);
+    //decoded source of image i, decoding it on this thread (or waiting for a loader) if it isn't ready; NULL if it can't be decoded
+    std::shared_ptr<const planarImage> acquire(int i);
+    //queues image i for decoding in the background if it isn't cached yet
+    void prefetch(int i);
+    //remembers a width x height RGB24 frame as image i's output for params
+    void storeOutput(int i, const unsigned char* pixels, int width, int height, const renderParams& params);
+    //image i's stored output if it was made with the same settings as params, else NULL
+    std::shared_ptr<const std::vector<unsigned char> > findOutput(int i, const renderParams& params, int& width, int& height);
+    //source hits/misses count acquire() calls; output ones count findOutput()
+    long long returnHits();
+    long long returnMisses();
+    long long returnOutputHits();
+    long long returnOutputMisses();
+    long long returnEvictions();
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include "kernels.h"
+
+#include <algorithm>
+#include <vector>
+
+//outputs each specialized block sums in registers before storing (two SSE registers)
+#define FIXED_LANES 8
+
+//the unrolled taps only pay off if every lambda is inlined, which GCC stops doing past a few dozen
+#if defined(__GNUC__)
+#define FIXED_INLINE __attribute__((flatten))
+#else
+#define FIXED_INLINE
+#endif
+
+//calls f(0), f(1), ..., f(N - 1) with the loop unrolled at compile time
+template<int N> struct unrolled {
+  template<typename F> static inline void run(const F& f){
+    unrolled<N - 1>::run(f);
+    f(N - 1);
+  }
+};
+
+template<> struct unrolled<0> {
+  template<typename F> static inline void run(const F&){}
+};
+
+//
+// dst[x] = sum over i < ROWS, j < COLS of k[i * COLS + j] * src[i][x + j], for
+// x in [0, count) with count a multiple of FIXED_LANES. The taps are unrolled,
+// so the weights stay in registers and each block of FIXED_LANES outputs is
+// summed in registers and stored once, instead of once per tap.
+//
+template<int ROWS, int COLS>
+FIXED_INLINE static inline void tapBlocks(const float* const* src, float* __restrict dst, const float* __restrict k, int count){
+  for(int x = 0; x < count; x += FIXED_LANES){
+    float acc[FIXED_LANES];
+    for(int l = 0; l < FIXED_LANES; l++){
+      acc[l] = 0.0f;
+    }
+    unrolled<ROWS>::run([&](int i){
+      const float* s = src[i] + x;
+      unrolled<COLS>::run([&](int j){
+        float w = k[i * COLS + j];
+        for(int l = 0; l < FIXED_LANES; l++){
+          acc[l] = acc[l] + w * s[j + l];
+        }
+      });
+    });
+    for(int l = 0; l < FIXED_LANES; l++){
+      dst[x + l] = acc[l];
+    }
+  }
+}
+
+//rounds up to whole FIXED_LANES blocks
+static int fixedSpan(int count){
+  return (count + FIXED_LANES - 1) / FIXED_LANES * FIXED_LANES;
+}
+
+//
+// Horizontal pass with radius R. Outputs far enough from the edges read the
+// row in place; only the R pixels at each end (plus the few left over after
+// the last whole block) go through a reflected copy.
+//
+template<int R>
+static void fixedRows(const planarImage& in, planarImage& out, int c, const float* kernel, const std::vector<int>& idx, int y0, int y1){
+  int width = in.returnWidth();
+  int left = std::min(R, width);
+  int interior = std::max(0, width - 2 * R) / FIXED_LANES * FIXED_LANES;
+  int right = std::max(0, width - left - interior);
+  std::vector<float> pad(fixedSpan(std::max(left, right)) + 2 * R), result(fixedSpan(std::max(left, right)));
+  const float* padded = &pad[0];
+  for(int y = y0; y < y1; y++){
+    const float* row = in.returnRow(c, y);
+    float* dst = out.returnRow(c, y);
+    tapBlocks<1, 2 * R + 1>(&row, dst + R, kernel, interior);
+    //the two borders: [0, left) and [left + interior, width)
+    for(int side = 0; side < 2; side++){
+      int x0 = side ? left + interior : 0, count = side ? right : left;
+      if(count == 0) continue;
+      std::fill(pad.begin(), pad.end(), 0.0f);
+      for(int i = 0; i < count + 2 * R; i++){
+        pad[i] = row[idx[x0 + i]];
+      }
+      tapBlocks<1, 2 * R + 1>(&padded, &result[0], kernel, fixedSpan(count));
+      std::copy(result.begin(), result.begin() + count, dst + x0);
+    }
+  }
+}
+
+//vertical pass with radius R; the reflected rows are looked up once per output row
+template<int R>
+static void fixedColumns(const planarImage& in, planarImage& out, int c, const float* kernel, const std::vector<int>& idx, int y0, int y1, int x0, int x1){
+  const float* rows[2 * R + 1];
+  for(int y = y0; y < y1; y++){
+    for(int t = 0; t < 2 * R + 1; t++){
+      rows[t] = in.returnRow(c, idx[y + t]) + x0;
+    }
+    tapBlocks<2 * R + 1, 1>(rows, out.returnRow(c, y) + x0, kernel, alignedSpan(x1 - x0));
+  }
+}
+
+//1D taps down 2R + 1 rows, or along one row, with nothing reflected
+template<int R>
+static void fixedVertical(const float* const* src, float* dst, const float* kernel, int count){
+  tapBlocks<2 * R + 1, 1>(src, dst, kernel, count);
+}
+
+template<int R>
+static void fixedHorizontal(const float* const* src, float* dst, const float* kernel, int count){
+  tapBlocks<1, 2 * R + 1>(src, dst, kernel, count);
+}
+
+//dispatch table indexed by radius; entry 0 is unused
+#define FIXED_ENTRY(R) {fixedRows<R>, fixedColumns<R>, fixedVertical<R>, fixedHorizontal<R>}
+static const fixedKernel fixedKernels[FIXED_RADIUS_MAX + 1] = {
+  {NULL, NULL, NULL, NULL},
+  FIXED_ENTRY(1),
+  FIXED_ENTRY(2),
+  FIXED_ENTRY(3),
+  FIXED_ENTRY(4),
+  FIXED_ENTRY(5),
+  FIXED_ENTRY(6),
+  FIXED_ENTRY(7),
+  FIXED_ENTRY(8)
+};
+
+const fixedKernel& fixedKernelFor(int radius){
+  return fixedKernels[radius];
+}
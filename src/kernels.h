@@ -0,0 +1,37 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "filter.h"
+
+#include <vector>
+
+//
+// Convolution passes compiled for one radius, with every tap unrolled, which
+// convolution() runs for radii up to FIXED_RADIUS_MAX. idx is a reflect
+// table as convolution() builds it (entry x + radius holds the reflected
+// index of x); outputs whose taps stay inside the image read the rows in
+// place and only the borders go through reflected copies.
+//
+//   rows: horizontal 1D pass over rows [y0, y1) with the 2 * radius + 1 weights
+//   columns: vertical 1D pass over rows [y0, y1) and columns [x0, x1)
+//   vertical, horizontal: the 1D taps over plain spans, dst[x] = sum of
+//     kernel[t] * src[t][x] or kernel[t] * src[0][x + t] for x in [0, count)
+//     with count a multiple of PLANE_ALIGN; no edges are handled (see
+//     convolveToneMapRGB24, which passes reflected copies)
+//
+typedef void (*fixedRowPass)(const planarImage&, planarImage&, int, const float*, const std::vector<int>&, int, int);
+typedef void (*fixedColumnPass)(const planarImage&, planarImage&, int, const float*, const std::vector<int>&, int, int, int, int);
+typedef void (*fixedSpanPass)(const float* const*, float*, const float*, int);
+
+//the specialized passes for one radius
+struct fixedKernel {
+  fixedRowPass rows;
+  fixedColumnPass columns;
+  fixedSpanPass vertical;
+  fixedSpanPass horizontal;
+};
+
+//the passes for radius, which must be in [1, FIXED_RADIUS_MAX]
+const fixedKernel& fixedKernelFor(int radius);
+
+#endif
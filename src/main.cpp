@@ -1,6 +1,17 @@
 //include SDL2 libraries
 #include <SDL.h>
 #include "ppm.h"
+#include "filter.h"
+#include "tonemap.h"
+#include "threadpool.h"
+#include "framebuffer.h"
+#include "batch.h"
+#include "graph.h"
+#include "preview.h"
+#include "render.h"
+#include "profile.h"
+#include "imagecache.h"
+#include "session.h"
 
 //C++ includes
 #include <iostream>
@@ -8,9 +19,13 @@
 #include <cmath>
 #include <vector>
 #include <algorithm>
+#include <cstring>
 
 using namespace std;
 
+//frame statistics go to stdout at most this often
+#define STATS_INTERVAL_MS 1000
+
 
 ///
 /// Log an SDL error with some error message to the output stream of our
@@ -44,241 +59,92 @@ void renderTexture(SDL_Texture *tex, SDL_Renderer *ren, int x, int y){
 	SDL_RenderCopy(ren, tex, NULL, &dst);
 }
 
-//
-// Convolution function that applies a bilinear filter to the image data sent in.
-//
-// \param data Image data to be modified
-// \param width width of image
-// \param height height of image
-// \param out output data
-//
-void convolution(float* data, int width, int height, float* out, int radius, int type){
-	//Create temp 2D data to hold input
-	float tempData[height][3 * width];
-
-	//Kernel for image filter
-	float kernel[2 * radius + 1][2 * radius + 1];
-	/*float kernel[21][21] =
-	{
-		{0.001174, 0.001291,		0.001405,		0.001514,		0.001616,		0.001707,		0.001786,		0.001849,		0.001896,		0.001925,		0.001934,		0.001925,		0.001896,		0.001849,		0.001786,		0.001707,		0.001616,		0.001514,		0.001405,		0.001291,		0.001174},
-			{0.001291,		0.001419,		0.001545,		0.001665,		0.001777,		0.001877,		0.001964,		0.002033,		0.002085,		0.002116,		0.002127,		0.002116,		0.002085,		0.002033,		0.001964,		0.001877,		0.001777,		0.001665,		0.001545,		0.001419,		0.001291},
-		{0.001405,		0.001545,		0.001682,		0.001813,		0.001934,		0.002044,		0.002138,		0.002214,		0.00227,		0.002304,		0.002315,		0.002304,		0.00227,		0.002214,		0.002138,		0.002044,		0.001934,		0.001813,		0.001682,		0.001545,		0.001405},
-		{0.001514,		0.001665,		0.001813,		0.001954,		0.002085,		0.002203,		0.002304,		0.002386,		0.002446,		0.002483,		0.002496,		0.002483,		0.002446,		0.002386,		0.002304,		0.002203,		0.002085,		0.001954,		0.001813,		0.001665,		0.001514},
-		{0.001616,		0.001777,		0.001934,		0.002085,		0.002225,		0.00235,		0.002459,		0.002546,		0.00261,		0.00265,		0.002663,		0.00265,		0.00261,		0.002546,		0.002459,		0.00235,		0.002225,		0.002085,		0.001934,		0.001777,		0.001616},
-		{0.001707,		0.001877,		0.002044,		0.002203,		0.00235,		0.002483,		0.002597,		0.00269,		0.002758,		0.0028,		0.002814,		0.0028,		0.002758,		0.00269,		0.002597,		0.002483,		0.00235,		0.002203,		0.002044,		0.001877,		0.001707},
-		{0.001786,		0.001964,		0.002138,		0.002304,		0.002459,		0.002597,		0.002717,		0.002814,		0.002885,		0.002928,		0.002943,		0.002928,		0.002885,		0.002814,		0.002717,		0.002597,		0.002459,		0.002304,		0.002138,		0.001964,		0.001786},
-		{0.001849,		0.002033,		0.002214,		0.002386,		0.002546,		0.00269,		0.002814,		0.002914,		0.002987,		0.003033,		0.003048,		0.003033,		0.002987,		0.002914,		0.002814,		0.00269,		0.002546,		0.002386,		0.002214,		0.002033,		0.001849},
-		{0.001896,		0.002085,		0.00227,		0.002446,		0.00261,		0.002758,		0.002885,		0.002987,		0.003063,		0.003109,		0.003125,		0.003109,		0.003063,		0.002987,		0.002885,		0.002758,		0.00261,		0.002446,		0.00227,		0.002085,		0.001896},
-		{0.001925,		0.002116,		0.002304,		0.002483,		0.00265,		0.0028,		0.002928,		0.003033,		0.003109,		0.003156,		0.003172,		0.003156,		0.003109,		0.003033,		0.002928,		0.0028,		0.00265,		0.002483,		0.002304,		0.002116,		0.001925},
-		{0.001934,		0.002127,		0.002315,		0.002496,		0.002663,		0.002814,		0.002943,		0.003048,		0.003125,		0.003172,		0.003188,		0.003172,		0.003125,		0.003048,		0.002943,		0.002814,		0.002663,		0.002496,		0.002315,		0.002127,		0.001934},
-		{0.001925,		0.002116,		0.002304,		0.002483,		0.00265,		0.0028,		0.002928,		0.003033,		0.003109,		0.003156,		0.003172,		0.003156,		0.003109,		0.003033,		0.002928,		0.0028,		0.00265,		0.002483,		0.002304,		0.002116,		0.001925},
-		{0.001896,		0.002085,		0.00227,		0.002446,		0.00261,		0.002758,		0.002885,		0.002987,		0.003063,		0.003109,		0.003125,		0.003109,		0.003063,		0.002987,		0.002885,		0.002758,		0.00261,		0.002446,		0.00227,		0.002085,		0.001896},
-		{0.001849,		0.002033,		0.002214,		0.002386,		0.002546,		0.00269,		0.002814,		0.002914,		0.002987,		0.003033,		0.003048,		0.003033,		0.002987,		0.002914,		0.002814,		0.00269,		0.002546,		0.002386,		0.002214,		0.002033,		0.001849},
-		{0.001786,		0.001964,		0.002138,		0.002304,		0.002459,		0.002597,		0.002717,		0.002814,		0.002885,		0.002928,		0.002943,		0.002928,		0.002885,		0.002814,		0.002717,		0.002597,		0.002459,		0.002304,		0.002138,		0.001964,		0.001786},
-		{0.001707,		0.001877,		0.002044,		0.002203,		0.00235,		0.002483,		0.002597,		0.00269,		0.002758,		0.0028,		0.002814,		0.0028,		0.002758,		0.00269,		0.002597,		0.002483,		0.00235,		0.002203,		0.002044,		0.001877,		0.001707},
-		{0.001616,		0.001777,		0.001934,		0.002085,		0.002225,		0.00235,		0.002459,		0.002546,		0.00261,		0.00265,		0.002663,		0.00265,		0.00261,		0.002546,		0.002459,		0.00235,		0.002225,		0.002085,		0.001934,		0.001777,		0.001616},
-		{0.001514,		0.001665,		0.001813,		0.001954,		0.002085,		0.002203,		0.002304,		0.002386,		0.002446,		0.002483,		0.002496,		0.002483,		0.002446,		0.002386,		0.002304,		0.002203,		0.002085,		0.001954,		0.001813,		0.001665,		0.001514},
-		{0.001405,		0.001545,		0.001682,		0.001813,		0.001934,		0.002044,		0.002138,		0.002214,		0.00227,		0.002304,		0.002315,		0.002304,		0.00227,		0.002214,		0.002138,		0.002044,		0.001934,		0.001813,		0.001682,		0.001545,		0.001405},
-		{0.001291,		0.001419,		0.001545,		0.001665,		0.001777,		0.001877,		0.001964,		0.002033,		0.002085,		0.002116,		0.002127,		0.002116,		0.002085,		0.002033,		0.001964,		0.001877,		0.001777,		0.001665,		0.001545,		0.001419,		0.001291},
-		{0.001174,		0.001291,		0.001405,		0.001514,		0.001616,		0.001707,		0.001786,		0.001849,		0.001896,		0.001925,		0.001934,		0.001925,		0.001896,		0.001849,		0.001786,		0.001707,		0.001616,		0.001514,		0.001405,		0.001291,		0.001174}
-	};*/
-
-	//vars used in calculation
-	int i, j, a, offset, k = 0, b = 0;
-	float w, sum = 0.0, distance, calculatedEuler = 1.0 / (2.0 * M_PI, powf(radius / 3.0, 2));
-	offset = radius;
-
-	//populate kernel
-	for(i = 0; i < (2 * radius + 1); i++){
-		for(j = 0; j < (2 * radius + 1); j++){
-			if(type == 0){
-				kernel[i][j] = 1.0 / ((2.0 * radius + 1.0) * (2.0 * radius + 1.0));
-			} else if (type == 1){
-				distance = (i * i) + (j * j) /(2 * (radius / 3.0) * (radius / 3.0));
-				kernel[i][j] = calculatedEuler * exp(-1.0 * distance);
-				sum = sum + kernel[i][j];
-			} else {
-				if(i == radius && j == radius) kernel[i][j] = ((2.0 * radius + 1.0) * (2.0 * radius + 1.0)) - 1.0;
-				else kernel[i][j] = -1;
-			}
-		}
-	}
-	if(type == 1){
-		for(i = 0; i < (2 * radius + 1); i++){
-			for(j = 0; j < (2 * radius + 1); j++){
-				kernel[i][j] = (1.0 / sum) * kernel[i][j];
-			}
-		}
-	}
-
-	//convert 1D input array to a 2D array
-	for(i = 0; i < height; i++){
-		for(j = 0; j < 3 * width; j++){
-			tempData[i][j] = data[k];
-			k++;
-		}
-	}
 
-	//actual convolution
-	//red
-	for(k = 0; k < height; k++){
-		for(a = 0; a < width; a = a + 3){
-			for(i = (k - 3 * offset); i < (k + 3 * offset + 3); i = i + 3){
-				for(j = (a - 3 * offset); j <  (a + 3 * offset + 3); j = j + 3){
-
-					//calculate weight for bilinear filter
-					// w = tempData[k][a] - tempData[i][j] / 2.0;
-					// w = w * w;
-					// if(w < 0.0) w = 0.0;
-					// else if (w > 1.0) w = 1.0;
-					// w = exp(-1.0 * w);
-
-					//handling boundaries; uses boundary padding through reflection for its boundary condition
-					if(i < 0 && j < 0) sum = sum + w * tempData[i + offset][j + offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i < 0 && j < (width - 1)) sum = sum + w * tempData[i + offset][j] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i < (height - 1) && j < 0) sum = sum + w * tempData[i][j + offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i < 0 && j > (width - 1)) sum = sum + w * tempData[i + offset][j - offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i > (height - 1) && j < 0) sum = sum + w * tempData[i - offset][j + offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i > (height - 1) && j > (width - 1)) sum = sum + w * tempData[i - offset][j - offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i > (height - 1)) sum = sum + w * tempData[i - offset][j] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (j > (width - 1)) sum = sum + w * tempData[i][j - offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else sum = sum + w * tempData[i][j] * kernel[i - (k - offset)][j - (a - offset)];
-				}
-			}
-			//store summation for each pixel in the pixel location
-			out[b] = sum;
-			b = b + 3;
+///
+/// Draw an SDL_Texture to an SDL_Renderer scaled to fill the given rectangle
+///
+/// \param tex The source texture we want to draw
+/// \param ren The renderer we want to draw to
+/// \param x The x coordinate to draw to
+/// \param y The y coordinate to draw to
+/// \param w The width to stretch the texture to
+/// \param h The height to stretch the texture to
+///
+void renderTextureStretched(SDL_Texture *tex, SDL_Renderer *ren, int x, int y, int w, int h){
+	SDL_Rect dst;
+	dst.x = x;
+	dst.y = y;
+	dst.w = w;
+	dst.h = h;
+	SDL_RenderCopy(ren, tex, NULL, &dst);
+}
 
-			//reset sum
-			sum = 0.0;
-		}
+///
+/// Copy rows [top, bottom) of an RGB24 frame straight into the memory of a
+/// streaming texture
+///
+/// \param tex The streaming texture to write to
+/// \param pixels The whole frame, 3 * w bytes per row
+/// \param w The width of the frame and the texture
+/// \param top The first row to copy
+/// \param bottom One past the last row to copy
+///
+void uploadRows(SDL_Texture *tex, const unsigned char *pixels, int w, int top, int bottom){
+	static profileStage* stage = profileStageFor("upload");
+	scopedTimer timer(stage, (long long)w * (bottom - top));
+	SDL_Rect rect;
+	rect.x = 0;
+	rect.y = top;
+	rect.w = w;
+	rect.h = bottom - top;
+	void *dst;
+	int pitch;
+	if(SDL_LockTexture(tex, &rect, &dst, &pitch) != 0){
+		logSDLError(std::cout, "LockTexture");
+		return;
 	}
-
-	//green
-	b = 1;
-	for(k = 0; k < height; k++){
-		for(a = 1; a < width; a = a + 3){
-			for(i = (k - 3 * offset + 1); i < (k + 3 * offset + 4); i = i + 3){
-				for(j = (a - 3 * offset + 1); j <  (a + 3 * offset + 4); j = j + 3){
-
-					//calculate weight for bilinear filter
-					// w = tempData[k][a] - tempData[i][j] / 2.0;
-					// w = w * w;
-					// if(w < 0.0) w = 0.0;
-					// else if (w > 1.0) w = 1.0;
-					// w = exp(-1.0 * w);
-
-					//handling boundaries; uses boundary padding through reflection for its boundary condition
-					if(i < 0 && j < 0) sum = sum + w * tempData[i + offset][j + offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i < 0 && j < (width - 1)) sum = sum + w * tempData[i + offset][j] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i < (height - 1) && j < 0) sum = sum + w * tempData[i][j + offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i < 0 && j > (width - 1)) sum = sum + w * tempData[i + offset][j - offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i > (height - 1) && j < 0) sum = sum + w * tempData[i - offset][j + offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i > (height - 1) && j > (width - 1)) sum = sum + w * tempData[i - offset][j - offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i > (height - 1)) sum = sum + w * tempData[i - offset][j] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (j > (width - 1)) sum = sum + w * tempData[i][j - offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else sum = sum + w * tempData[i][j] * kernel[i - (k - offset)][j - (a - offset)];
-				}
-			}
-			//store summation for each pixel in the pixel location
-			out[b] = sum;
-			b = b + 3;
-
-			//reset sum
-			sum = 0.0;
-		}
+	//the texture's rows can be padded, so copy one row at a time
+	for(int y = top; y < bottom; y++){
+		memcpy((unsigned char*)dst + (size_t)pitch * (y - top), pixels + 3 * (size_t)w * y, 3 * w);
 	}
+	SDL_UnlockTexture(tex);
+}
 
-	b = 2;
-	//blue
-	for(k = 0; k < height; k++){
-		for(a = 2; a < width; a = a + 3){
-			for(i = (k - 3 * offset + 2); i < (k + 3 * offset + 5); i = i + 3){
-				for(j = (a - 3 * offset + 2); j <  (a + 3 * offset + 5); j = j + 3){
-
-					//calculate weight for bilinear filter
-					// w = tempData[k][a] - tempData[i][j] / 2.0;
-					// w = w * w;
-					// if(w < 0.0) w = 0.0;
-					// else if (w > 1.0) w = 1.0;
-					// w = exp(-1.0 * w);
-
-					//handling boundaries; uses boundary padding through reflection for its boundary condition
-					if(i < 0 && j < 0) sum = sum + w * tempData[i + offset][j + offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i < 0 && j < (width - 1)) sum = sum + w * tempData[i + offset][j] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i < (height - 1) && j < 0) sum = sum + w * tempData[i][j + offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i < 0 && j > (width - 1)) sum = sum + w * tempData[i + offset][j - offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i > (height - 1) && j < 0) sum = sum + w * tempData[i - offset][j + offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i > (height - 1) && j > (width - 1)) sum = sum + w * tempData[i - offset][j - offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (i > (height - 1)) sum = sum + w * tempData[i - offset][j] * kernel[i - (k - offset)][j - (a - offset)];
-					else if (j > (width - 1)) sum = sum + w * tempData[i][j - offset] * kernel[i - (k - offset)][j - (a - offset)];
-					else sum = sum + w * tempData[i][j] * kernel[i - (k - offset)][j - (a - offset)];
-				}
-			}
-			//store summation for each pixel in the pixel location
-			out[b] = sum;
-			b = b + 3;
-
-			//reset sum
-			sum = 0.0;
-		}
+///
+/// Make sure a streaming RGB24 texture is w x h, replacing it with a new one
+/// if it isn't
+///
+/// \param ren The renderer the texture belongs to
+/// \param tex The current texture, or NULL
+/// \param w The width needed
+/// \param h The height needed
+/// \return the texture to draw with from now on (NULL if it couldn't be created)
+///
+SDL_Texture* fitTexture(SDL_Renderer *ren, SDL_Texture *tex, int w, int h){
+	if(tex != NULL){
+		int tw, th;
+		SDL_QueryTexture(tex, NULL, NULL, &tw, &th);
+		if(tw == w && th == h) return tex;
+		SDL_DestroyTexture(tex);
 	}
+	tex = SDL_CreateTexture(ren, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, w, h);
+	if(tex == NULL) logSDLError(std::cout, "CreateTexture");
+	return tex;
 }
 
-//
-// Tone Maps the HDR data by applying gamma correction
-// \param data data to gamma correct
-// \param gamma value to correct by
-// \param size size of data
-//
-float* toneMap(float* data, float gamma, float gain, float bias, int size){
-	//To store L in
-	float* lumData = new float[size];
-
-	//Store L-corrected in
-	float* lum2 = new float[size];
-
-	//output data
-	float* newData = new float[3*size];
-
-	//vars used for calcuation
-	float scale;
-	int i = 0;
-	float r, g, b;
-
-	//the loop itself
-	for(i = 0; i < size; i++){
-		//loading in values
-		r = data[3 * i];
-		g = data[(3 * i) + 1];
-		b = data[(3 * i) + 2];
-
-		//calculating L
-		lumData[i] = (1.0 / 61.0) * (20.0 * r + 40.0 * g + b);
-
-		//calcualating L corrected
-		lum2[i] = powf((gain * lumData[i] + bias), gamma);
-
-		//calculating scale to correct by
-		scale = lum2[i] / lumData[i];
-
-		//correcting original values and clamping
-		r = r * scale;
-		if(r > 255) r = 255;
-		else if (r < 0.0) r = 0.0;
-		g = g * scale;
-		if(g > 255) g = 255;
-		else if (g < 0.0) g = 0.0;
-		b = b * scale;
-		if(b > 255) b = 255;
-		else if (b < 0.0) b = 0.0;
-
-		//saving corrected values
-		newData[3 * i] = round(r);
-		newData[(3 * i) + 1] = round(g);
-		newData[(3 * i) + 2] = round(b);
+///
+/// Queue the inputs on either side of the current one for decoding, nearest
+/// first, so stepping to them doesn't wait on the disk
+///
+/// \param cache The viewer's image cache
+/// \param index The input being shown
+///
+void prefetchAround(imageCache &cache, int index){
+	int count = cache.returnCount();
+	for(int d = 1; d <= IMAGE_PREFETCH && d < count; d++){
+		cache.prefetch((index + d) % count);
+		cache.prefetch((index - d + count) % count);
 	}
-	return newData;
 }
 
 ///
@@ -294,10 +160,33 @@ int main(int argc, char** argv) {
 
 	//vars used for new code--loading in image, perform corrections, display and output.
 	float gamma = 1.0, bias = 1.0, gain = 1.0;
+	//tone operator, and whether gain and bias are measured from the image
+	int op = TONE_POWER;
+	bool autoExposed = false;
 	ppm* image = new ppm();
-	int width, height, radius = 1, type = -1;
-	float* data;
-	float* newData;
+	int width, height, radius = 1, type = -1, current = 0;
+	unsigned char* pixels;
+	frameBuffers buffers;
+	//load -> convolve -> tone map -> upload; each stage only reruns when its inputs change
+	processingGraph graph(&buffers);
+	//downsampled copy of the pipeline that edits apply to first on large images
+	previewPipeline preview;
+	bool showPreview = false, toneChanged = false, filterChanged = false, imageChanged = false;
+	//latest settings, handed to the render thread whenever a key changes them
+	renderParams params;
+	params.toneSet = false;
+	params.filterSet = false;
+	params.serial = 0;
+
+	//headless mode never touches SDL
+	if(argc > 1 && strcmp(argv[1], "-batch") == 0){
+		delete image;
+		return runBatch(argc - 2, argv + 2);
+	}
+	if(argc > 1 && strcmp(argv[1], "-replay") == 0){
+		delete image;
+		return runReplay(argc - 2, argv + 2);
+	}
 
   //Start up SDL and make sure it went ok
 	if (SDL_Init(SDL_INIT_VIDEO) != 0){
@@ -307,17 +196,96 @@ int main(int argc, char** argv) {
 
 	//setup for loading image; create new object and check commandline args
 	if(argc < 3){
-		cout << "usage: prog02 input output" << endl;
+		cout << "usage: prog02 input output [-t threads] [-cache MB] [-fused] [-profile summary.json] [-trace trace.json] [-record session.txt] [-replay session.txt [-realtime]] [-preset session.txt] [more inputs...]" << endl;
 		exit(EXIT_FAILURE);
 	}
 
-	//Try to figure out if it's a ppm or a hdr image
+	//optional flags after the input and output names; any other argument is another input to page through
+	std::string profileName, traceName, recordName, replayName, presetName;
+	bool realtime = false;
+	std::vector<std::string> inputs(1, argv[1]);
+	size_t cacheBudget = (size_t)IMAGE_CACHE_BUDGET_MB << 20;
+	for(int i = 3; i < argc; i++){
+		if(strcmp(argv[i], "-t") == 0 && i + 1 < argc){
+			//number of worker threads for the filters; 0 uses every core
+			setPoolThreads(atoi(argv[++i]));
+		} else if(strcmp(argv[i], "-profile") == 0 && i + 1 < argc){
+			//per stage timings written out as JSON on exit
+			profileName = argv[++i];
+		} else if(strcmp(argv[i], "-trace") == 0 && i + 1 < argc){
+			//every timed stage as a Chrome trace, written on exit
+			traceName = argv[++i];
+		} else if(strcmp(argv[i], "-fused") == 0){
+			//convolve and tone map the full resolution frame in one pass, instead of caching filtered images
+			graph.setFused(true);
+		} else if(strcmp(argv[i], "-cache") == 0 && i + 1 < argc){
+			//memory for decoded inputs and their outputs, in megabytes
+			cacheBudget = (size_t)std::max(0, atoi(argv[++i])) << 20;
+		} else if(strcmp(argv[i], "-record") == 0 && i + 1 < argc){
+			//every change of settings, with its time, so the session can be replayed later
+			recordName = argv[++i];
+		} else if(strcmp(argv[i], "-replay") == 0 && i + 1 < argc){
+			//drive the viewer from a recorded session and report how long each step took to show
+			replayName = argv[++i];
+		} else if(strcmp(argv[i], "-realtime") == 0){
+			//replay steps at their recorded times instead of as fast as frames come back
+			realtime = true;
+		} else if(strcmp(argv[i], "-preset") == 0 && i + 1 < argc){
+			//start from the settings a session ended with
+			presetName = argv[++i];
+		} else if(argv[i][0] == '-'){
+			//a mistyped flag, or one missing its value, would otherwise be taken for an input
+			cout << "Unknown option " << argv[i] << " (or it is missing its value)" << endl;
+			exit(EXIT_FAILURE);
+		} else {
+			inputs.push_back(argv[i]);
+		}
+	}
+	if(!inputsReadable(inputs)) exit(EXIT_FAILURE);
+	setProfiling(!profileName.empty() || !traceName.empty(), !traceName.empty());
+	sessionRecorder recorder;
+	if(!recordName.empty() && !recorder.begin(recordName)) exit(EXIT_FAILURE);
+	sessionPlayer player;
+	if(!replayName.empty() && !player.load(replayName, realtime)) exit(EXIT_FAILURE);
+	std::vector<sessionStep> preset;
+	if(!presetName.empty() && !readSession(presetName, preset)) exit(EXIT_FAILURE);
+	profileStage* loadStage = profileStageFor("load");
+	profileStage* presentStage = profileStageFor("present");
+
+	//decoded inputs, and the last output of each, kept around so paging back and forth doesn't decode again
+	imageCache cache(inputs, cacheBudget);
+	params.gamma = gamma;
+	params.gain = gain;
+	params.bias = bias;
+	params.op = op;
+	params.autoExposure = autoExposed;
+	params.radius = radius;
+	params.type = type;
+	params.image = current;
+
+	//decoding and building the preview pyramid are timed together as the load stage
+	{
+		scopedTimer loadTimer(loadStage);
+		std::shared_ptr<const planarImage> first = cache.acquire(current);
+		if(!first){
+			SDL_Quit();
+			return 1;
+		}
+		//float copy of the source for the filters, filtered result, and the 8 bit frame that gets displayed;
+		//resized only when an input of another size is loaded
+		loadSource(&graph, &preview, &buffers, *first, params);
+		width = buffers.returnWidth();
+		height = buffers.returnHeight();
+		pixels = buffers.returnDisplay();
+		loadTimer.setPixels((long long)width * height);
+	}
+	prefetchAround(cache, current);
 
-	//read in image data if ppm
-	image->readData(argv[1]);
+	//filtering happens on its own thread from here on; finished frames come back through takeFrame
+	renderThread render(&graph, &preview, &buffers, &cache, current);
 
  //create window for the image, then check to make sure it loaded properly
- SDL_Window *windowImage = SDL_CreateWindow("Loaded Image", 100, 100, image->returnWidth(), image->returnHeight(), SDL_WINDOW_SHOWN);
+ SDL_Window *windowImage = SDL_CreateWindow(inputs[current].c_str(), 100, 100, width, height, SDL_WINDOW_SHOWN);
  if (windowImage == NULL){
 	 logSDLError(std::cout, "CreateWindowImage");
 	 SDL_Quit();
@@ -337,47 +305,128 @@ int main(int argc, char** argv) {
 	SDL_Texture *imageTexture;
 
   //Initialize the texture.  SDL_PIXELFORMAT_RGB24 specifies 3 bytes per
-  //pixel, one per color channel
-	imageTexture = SDL_CreateTexture(rendererImage,SDL_PIXELFORMAT_RGB24,SDL_TEXTUREACCESS_STATIC,image->returnWidth(),image->returnHeight());
-
-	//Copy the raw data array into the texture.
-	SDL_UpdateTexture(imageTexture, NULL, image->returnData(), 3*image->returnWidth());
-  if (imageTexture == NULL){
-    logSDLError(std::cout, "CreateImageTextureFromSurface");
-  }
+  //pixel, one per color channel. Streaming textures are written in place
+  //through SDL_LockTexture instead of being copied in by SDL_UpdateTexture
+	imageTexture = SDL_CreateTexture(rendererImage,SDL_PIXELFORMAT_RGB24,SDL_TEXTUREACCESS_STREAMING,width,height);
+
+	//Texture for the downsampled preview; stretched over the window while the full frame catches up
+	SDL_Texture *previewTexture = NULL;
+	if(preview.enabled()){
+		previewTexture = SDL_CreateTexture(rendererImage, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, preview.returnWidth(), preview.returnHeight());
+		if(previewTexture == NULL) logSDLError(std::cout, "CreatePreviewTexture");
+	}
 
   //Make sure it loaded ok
 	if (imageTexture == NULL){
-    SDL_DestroyTexture(imageTexture);
+    logSDLError(std::cout, "CreateImageTexture");
     SDL_DestroyRenderer(rendererImage);
     SDL_DestroyWindow(windowImage);
 		SDL_Quit();
 		return 1;
 	}
 
+	//Copy the first frame into the texture; the shadows remember what each texture holds so later frames only upload changed rows
+	textureShadow imageShadow, previewShadow;
+	int top, bottom;
+	if(imageShadow.update(pixels, width, height, top, bottom)) uploadRows(imageTexture, pixels, width, top, bottom);
+
 	//render loaded texture here
 	renderTexture(imageTexture, rendererImage, 0, 0);
 
 	//Update the screen
 	SDL_RenderPresent(rendererImage);
 
+	//the render thread wakes the event loop with this event whenever it publishes a frame
+	const Uint32 frameEvent = SDL_RegisterEvents(1);
+	render.setNotify([frameEvent](){
+		SDL_Event wake;
+		memset(&wake, 0, sizeof(wake));
+		wake.type = frameEvent;
+		SDL_PushEvent(&wake);
+	});
+	render.start();
+
+	//takes on the settings of a replayed step or preset; inputs the session didn't have are left alone
+	auto adopt = [&](const renderParams& p){
+		gamma = p.gamma;
+		gain = p.gain;
+		bias = p.bias;
+		op = p.op;
+		autoExposed = p.autoExposure;
+		radius = p.radius;
+		type = p.type;
+		toneChanged = toneChanged || p.toneSet;
+		filterChanged = filterChanged || p.filterSet;
+		if(p.image != current && p.image < cache.returnCount()){
+			current = p.image;
+			imageChanged = true;
+		}
+	};
+	//hands the newest settings to the render thread; anything it hasn't started on yet is replaced
+	auto postSettings = [&](bool replayed){
+		params.gamma = gamma;
+		params.gain = gain;
+		params.bias = bias;
+		params.op = op;
+		params.autoExposure = autoExposed;
+		params.radius = radius;
+		params.type = type;
+		params.image = current;
+		params.toneSet = params.toneSet || toneChanged;
+		params.filterSet = params.filterSet || filterChanged;
+		params.serial++;
+		render.post(params);
+		recorder.record(params);
+		if(replayed) player.posted(params.serial);
+		if(imageChanged){
+			//the window title says which input is up; its neighbours start decoding now
+			SDL_SetWindowTitle(windowImage, inputs[current].c_str());
+			prefetchAround(cache, current);
+		}
+		toneChanged = false;
+		filterChanged = false;
+		imageChanged = false;
+	};
+	if(!preset.empty()){
+		adopt(preset.back().params);
+		postSettings(false);
+	}
+	bool replaying = !replayName.empty();
+	if(replaying) player.begin();
+
   //Variables used in the rendering loop
   SDL_Event event;
 	bool quit = false;
+	//set when the window has to be drawn again (new frame, or the window was uncovered)
+	bool redraw = false;
+	//stats since the last line printed
+	int presented = 0;
+	double busySeconds = 0.0;
+	Uint32 lastStats = SDL_GetTicks();
 
 	while (!quit){
+		//Sleep until something happens; nothing is drawn or uploaded while the viewer is idle
+		if(replaying){
+			//a replay also wakes up when its next step is due; a timeout leaves the empty event
+			memset(&event, 0, sizeof(event));
+			SDL_WaitEventTimeout(&event, player.returnWait());
+		} else if(!SDL_WaitEvent(&event)){
+			logSDLError(std::cout, "WaitEvent");
+			break;
+		}
+
     //Grab the time for frame rate computation
     const Uint64 start = SDL_GetPerformanceCounter();
 
-    //Clear the screen
-		SDL_RenderClear(rendererImage);
-
 		//Event Polling
-    //This while loop responds to mouse and keyboard commands.
-    while (SDL_PollEvent(&event)){
+    //This loop responds to mouse and keyboard commands, handling everything queued up before drawing
+		do {
 			if (event.type == SDL_QUIT){
 				quit = true;
 			}
+			if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_EXPOSED){
+				redraw = true;
+			}
       //Use number input to select which clip should be drawn
       if (event.type == SDL_KEYDOWN){
         switch (event.key.keysym.sym){
@@ -387,90 +436,170 @@ int main(int argc, char** argv) {
 					case SDLK_LEFT:
 						//if left arrow pressed, decrease gamma by 0.1 and tone map image again
 						gamma = gamma - 0.1;
-						newData = toneMap((float*)image->returnData(), gamma, gain, bias, width * height);
+						toneChanged = true;
 						break;
 					case SDLK_RIGHT:
 						//same as for left arrow, but for right arrow and increase gamma instead of decrease
 						gamma = gamma + 0.1;
-						newData = toneMap((float*)image->returnData(), gamma, gain, bias, width * height);
+						toneChanged = true;
 						break;
 					case SDLK_DOWN:
 						//if left arrow pressed, decrease gamma by 0.1 and tone map image again
 						gain = gain - 0.1;
-						newData = toneMap((float*)image->returnData(), gamma, gain, bias, width * height);
+						toneChanged = true;
 						break;
 					case SDLK_UP:
 						//same as for left arrow, but for right arrow and increase gamma instead of decrease
 						gain = gain + 0.1;
-						newData = toneMap((float*)image->returnData(), gamma, gain, bias, width * height);
+						toneChanged = true;
 						break;
 					case SDLK_a:
 						//if left arrow pressed, decrease gamma by 0.1 and tone map image again
 						bias = bias - 0.1;
-						newData = toneMap((float*)image->returnData(), gamma, gain, bias, width * height);
+						toneChanged = true;
 						break;
 					case SDLK_d:
 						//same as for left arrow, but for right arrow and increase gamma instead of decrease
 						bias = bias + 0.1;
-						newData = toneMap((float*)image->returnData(), gamma, gain, bias, width * height);
+						toneChanged = true;
+						break;
+					case SDLK_t:
+						//next tone operator: power, Reinhard, filmic, local Reinhard
+						op = (op + 1) % (TONE_LOCAL + 1);
+						toneChanged = true;
+						break;
+					case SDLK_e:
+						//auto exposure on/off; gain and bias are ignored while it's on
+						autoExposed = !autoExposed;
+						toneChanged = true;
 						break;
 					case SDLK_v:
 						//if left arrow pressed, decrease gamma by 0.1 and tone map image again
 						radius = radius - 1;
 						if(radius < 1) radius = 1;
-						convolution((float*)image->returnData(), image->returnWidth(), image->returnHeight(), newData, radius, type);
+						filterChanged = true;
 						break;
 					case SDLK_b:
 						//same as for left arrow, but for right arrow and increase gamma instead of decrease
 						radius = radius + 1;
-						convolution((float*)image->returnData(), image->returnWidth(), image->returnHeight(), newData, radius, type);
+						filterChanged = true;
 						break;
 					case SDLK_n:
 						//if left arrow pressed, decrease gamma by 0.1 and tone map image again
 						type = type - 1;
-						if(radius < 0) type = 0;
-						convolution((float*)image->returnData(), image->returnWidth(), image->returnHeight(), newData, radius, type);
+						if(type < 0) type = 0;
+						filterChanged = true;
 						break;
 					case SDLK_m:
 						//same as for left arrow, but for right arrow and increase gamma instead of decrease
 						type = type + 1;
-						if(type > 2) type = 2;
-						convolution((float*)image->returnData(), image->returnWidth(), image->returnHeight(), newData, radius, type);
+						if(type > KERNEL_BILATERAL) type = KERNEL_BILATERAL;
+						filterChanged = true;
+						break;
+					case SDLK_PAGEDOWN:
+						//next input, wrapping around after the last one
+						current = (current + 1) % cache.returnCount();
+						imageChanged = true;
+						break;
+					case SDLK_PAGEUP:
+						//previous input, wrapping around before the first one
+						current = (current + cache.returnCount() - 1) % cache.returnCount();
+						imageChanged = true;
 						break;
           default:
             break;
         }
       }
-    }
-		//if not a ppm, store data in one and update the texture with it
-		SDL_UpdateTexture(imageTexture, NULL, (unsigned char*)newData, 3*image->returnWidth());
+    } while (SDL_PollEvent(&event));
+		//a replayed step is posted even if it changes nothing, so its latency is measured like any other
+		bool replayed = false;
+		if(replaying && player.due()){
+			adopt(player.next());
+			replayed = true;
+		}
+		if(toneChanged || filterChanged || imageChanged || replayed) postSettings(replayed);
+		//upload whatever finished since the last frame, and only the rows that changed
+		const renderFrame* frame = render.takeFrame();
+		if(frame != NULL && (frame->imageWidth != width || frame->imageHeight != height)){
+			//an input of another size is up: the window follows it
+			width = frame->imageWidth;
+			height = frame->imageHeight;
+			SDL_SetWindowSize(windowImage, width, height);
+			redraw = true;
+		}
+		if(frame != NULL && frame->full){
+			imageTexture = fitTexture(rendererImage, imageTexture, frame->width, frame->height);
+			if(imageTexture != NULL && imageShadow.update(&frame->pixels[0], frame->width, frame->height, top, bottom)){
+				uploadRows(imageTexture, &frame->pixels[0], frame->width, top, bottom);
+			}
+			redraw = redraw || showPreview || top < bottom;
+			showPreview = false;
+		} else if(frame != NULL){
+			//an input may only be large enough for a preview after a smaller one was shown
+			previewTexture = fitTexture(rendererImage, previewTexture, frame->width, frame->height);
+			if(previewTexture != NULL && previewShadow.update(&frame->pixels[0], frame->width, frame->height, top, bottom)){
+				uploadRows(previewTexture, &frame->pixels[0], frame->width, top, bottom);
+			}
+			redraw = redraw || !showPreview || top < bottom;
+			showPreview = true;
+		}
+		//the first frame made with a step's settings, preview or full, ends its latency
+		if(replaying && frame != NULL) player.shown(frame->serial);
+		if(replaying && !player.active()){
+			player.printSummary();
+			replaying = false;
+			quit = true;
+		}
+
+		if(redraw && (showPreview ? previewTexture : imageTexture) != NULL){
+			//Clear the screen
+			SDL_RenderClear(rendererImage);
 
 			//render loaded texture here
-		renderTexture(imageTexture, rendererImage, 0, 0);
+			if(showPreview) renderTextureStretched(previewTexture, rendererImage, 0, 0, width, height);
+			else renderTexture(imageTexture, rendererImage, 0, 0);
 
 			//Update the screen
-		SDL_RenderPresent(rendererImage);
+			scopedTimer timer(presentStage);
+			SDL_RenderPresent(rendererImage);
+			redraw = false;
+			presented++;
+		}
 
-    //Display the frame rate to stdout, as well as current gamma value
+    //Time spent handling this wake up, reported with the current gamma at most once per STATS_INTERVAL_MS
     const Uint64 end = SDL_GetPerformanceCounter();
     const static Uint64 freq = SDL_GetPerformanceFrequency();
-    const double seconds = ( end - start ) / static_cast< double >( freq );
-
-    //You may want to comment this line out for debugging purposes
-    cout << "Frame time: " << seconds * 1000.0 << "ms" << endl;
-		cout << "Gamma: " << gamma << endl;
+    busySeconds = busySeconds + ( end - start ) / static_cast< double >( freq );
+		//a replay's CSV has stdout to itself
+		if(presented > 0 && !replaying && SDL_GetTicks() - lastStats >= STATS_INTERVAL_MS){
+			cout << "Frames: " << presented << ", avg frame time: " << busySeconds * 1000.0 / presented << "ms, gamma: " << gamma << "\n";
+			presented = 0;
+			busySeconds = 0.0;
+			lastStats = SDL_GetTicks();
+		}
   }
 
   //After the loop finishes (when the window is closed, or escape is
   //pressed, clean up the data that we allocated.
-	SDL_DestroyTexture(imageTexture);
+	if(previewTexture != NULL) SDL_DestroyTexture(previewTexture);
+	if(imageTexture != NULL) SDL_DestroyTexture(imageTexture);
 	SDL_DestroyRenderer(rendererImage);
 	SDL_DestroyWindow(windowImage);
 	SDL_Quit();
 
-	//write data to a SDR ppm
-	image->setData((unsigned char*)newData);
-	image->writeData(argv[2]);
+	//make sure the output reflects the last edit at full resolution
+	render.stop();
+	cout << "Filter runs: " << graph.returnFilterRuns() << " (cache hits: " << graph.returnFilterHits() << "), tone map runs: " << graph.returnToneRuns() << ", fused runs: " << graph.returnFusedRuns() << endl;
+	cout << "Image cache: " << cache.returnHits() << " hits, " << cache.returnMisses() << " misses; outputs: " << cache.returnOutputHits() << " hits, " << cache.returnOutputMisses() << " misses; evictions: " << cache.returnEvictions() << endl;
+
+	//write the input on screen at exit to a SDR ppm
+	image->setWidth(buffers.returnWidth());
+	image->setHeight(buffers.returnHeight());
+	image->setData(buffers.returnDisplay());
+	if(!image->writeData(argv[2])) cout << "Could not write " << argv[2] << endl;
+
+	if(!profileName.empty()) writeProfile(profileName);
+	if(!traceName.empty()) writeTrace(traceName);
 
 	//clear memory
 	delete image;
@@ -1,59 +1,414 @@
 #include "ppm.h"
+#include "profile.h"
+
+#include <cctype>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PPM_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __SSE2__
+#define PPM_SSE2 1
+#include <emmintrin.h>
+#endif
+
+//the header has to fit in this many bytes (comments included)
+#define PPM_HEADER_MAX 65536
+//bytes read at a time for ASCII pixels
+#define PPM_READ_CHUNK 65536
+//ASCII input is topped up whenever fewer bytes than this are left, so no number is split between reads
+#define PPM_TOKEN_MAX 256
+//larger header numbers are rejected rather than overflowing
+#define PPM_NUMBER_MAX 100000000
+//samples per line of ASCII output (three pixels, well inside the 70 characters P3 allows)
+#define PPM_ASCII_LINE 9
 
 ppm::ppm(){
   this->data = NULL;
+  this->floatData = NULL;
   this->width = 0;
   this->height = 0;
   this->maxVal = 255;
+  this->format = PPM_BINARY;
+  this->outFormat = PPM_BINARY;
+  this->outMaxVal = 255;
+  this->littleEndian = true;
+  this->mapping = NULL;
+  this->mappingSize = 0;
+  this->view = NULL;
+  this->bufferPos = 0;
+  this->bufferLen = 0;
+  this->payload = 0;
+  this->row = 0;
+  this->outputPos = 0;
 }
-//loads in image data from filename argument
-void ppm::readData(std::string name){
-  std::ifstream input(name, std::ifstream::in | std::ifstream::binary);
-  std::string temp;
-  int i = 1;
+
+ppm::~ppm(){
+#ifdef PPM_MMAP
+  if(this->mapping != NULL) munmap(this->mapping, this->mappingSize);
+#endif
+}
+
+static bool hostLittleEndian(){
+  const unsigned one = 1;
+  return *(const unsigned char*)&one == 1;
+}
+
+//moves pos past whitespace and # comments
+static void skipSpace(const unsigned char* buf, size_t len, size_t& pos){
+  while(pos < len){
+    if(buf[pos] == '#'){
+      while(pos < len && buf[pos] != '\n') pos++;
+    } else if(isspace(buf[pos])){
+      pos++;
+    } else {
+      break;
+    }
+  }
+}
+
+//reads the next whitespace separated number in a header, skipping # comments
+static bool headerNumber(const unsigned char* buf, size_t len, size_t& pos, int& value){
+  skipSpace(buf, len, pos);
+  if(pos >= len || !isdigit(buf[pos])) return false;
+  value = 0;
+  while(pos < len && isdigit(buf[pos])){
+    value = 10 * value + (buf[pos] - '0');
+    if(value > PPM_NUMBER_MAX) return false;
+    pos++;
+  }
+  return true;
+}
+
+//reads the next decimal number in a header (the scale of a PFM)
+static bool headerFloat(const unsigned char* buf, size_t len, size_t& pos, float& value){
+  skipSpace(buf, len, pos);
+  char token[32];
+  int n = 0;
+  while(pos < len && n < 31 && (isdigit(buf[pos]) || buf[pos] == '-' || buf[pos] == '+' || buf[pos] == '.' || buf[pos] == 'e' || buf[pos] == 'E')){
+    token[n++] = buf[pos++];
+  }
+  token[n] = '\0';
+  char* end;
+  value = strtof(token, &end);
+  return n > 0 && *end == '\0';
+}
+
+//binary samples (8 bit, or 16 bit big endian when maxVal is over 255) to floats, 1.0 = maxVal
+static void decodeSamples(const unsigned char* in, float* out, size_t count, int maxVal){
+  const float scale = 1.0f / maxVal;
+  size_t i = 0;
+  if(maxVal <= 255){
+    for(; i < count; i++){
+      out[i] = in[i] * scale;
+    }
+    return;
+  }
+#ifdef PPM_SSE2
+  const __m128 s = _mm_set1_ps(scale);
+  const __m128i zero = _mm_setzero_si128();
+  for(; i + 8 <= count; i = i + 8){
+    __m128i v = _mm_loadu_si128((const __m128i*)(in + 2 * i));
+    //swap the two bytes of every lane
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), s));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), s));
+  }
+#endif
+  for(; i < count; i++){
+    out[i] = ((in[2 * i] << 8) | in[2 * i + 1]) * scale;
+  }
+}
+
+//0-1 to 0-top, rounded; NaN and anything out of range is clamped
+static inline int quantize(float x, float top){
+  x = x > 0.0f ? (x < 1.0f ? x : 1.0f) : 0.0f;
+  return (int)(x * top + 0.5f);
+}
+
+//floats to binary samples, the inverse of decodeSamples
+static void encodeSamples(const float* in, unsigned char* out, size_t count, int maxVal){
+  const float top = (float)maxVal;
+  size_t i = 0;
+  if(maxVal <= 255){
+    for(; i < count; i++){
+      out[i] = (unsigned char)quantize(in[i], top);
+    }
+    return;
+  }
+#ifdef PPM_SSE2
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), scale = _mm_set1_ps(top), half = _mm_set1_ps(0.5f);
+  const __m128i bias = _mm_set1_epi32(32768), flip = _mm_set1_epi16((short)0x8000);
+  for(; i + 8 <= count; i = i + 8){
+    //max picks zero for NaN, like quantize
+    __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), zero), one);
+    __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), zero), one);
+    __m128i ai = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(a, scale), half));
+    __m128i bi = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, scale), half));
+    //SSE2 only packs with signed saturation, so shift 0-65535 down into its range and back
+    __m128i v = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(ai, bias), _mm_sub_epi32(bi, bias)), flip);
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    _mm_storeu_si128((__m128i*)(out + 2 * i), v);
+  }
+#endif
+  for(; i < count; i++){
+    int q = quantize(in[i], top);
+    out[2 * i] = (unsigned char)(q >> 8);
+    out[2 * i + 1] = (unsigned char)(q & 255);
+  }
+}
+
+//copies count 32 bit floats, reversing the bytes of each when swap is set
+static void copyFloats(const unsigned char* in, unsigned char* out, size_t count, bool swap){
+  if(!swap){
+    memcpy(out, in, 4 * count);
+    return;
+  }
+  size_t i = 0;
+#ifdef PPM_SSE2
+  for(; i + 4 <= count; i = i + 4){
+    __m128i v = _mm_loadu_si128((const __m128i*)(in + 4 * i));
+    //swap the 16 bit halves of each lane, then the bytes of each half
+    v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    _mm_storeu_si128((__m128i*)(out + 4 * i), v);
+  }
+#endif
+  for(; i < count; i++){
+    out[4 * i] = in[4 * i + 3];
+    out[4 * i + 1] = in[4 * i + 2];
+    out[4 * i + 2] = in[4 * i + 1];
+    out[4 * i + 3] = in[4 * i];
+  }
+}
+
+//writes value in decimal followed by separator, returning the next free byte
+static unsigned char* writeSample(unsigned char* out, int value, unsigned char separator){
+  unsigned char digits[8];
+  int n = 0;
+  do {
+    digits[n++] = (unsigned char)('0' + value % 10);
+    value = value / 10;
+  } while(value > 0);
+  while(n > 0) *out++ = digits[--n];
+  *out++ = separator;
+  return out;
+}
+
+//parses a P6, P3 or PF header held in memory; offset is left on the first pixel byte
+bool ppm::parseHeader(const unsigned char* buf, size_t len, size_t& offset){
+  size_t pos = 2;
+  if(len < 2 || buf[0] != 'P') return false;
+  if(buf[1] == '6') this->format = PPM_BINARY;
+  else if(buf[1] == '3') this->format = PPM_ASCII;
+  else if(buf[1] == 'F') this->format = PPM_FLOAT;
+  else return false;
+  if(!headerNumber(buf, len, pos, this->width) || this->width <= 0) return false;
+  if(!headerNumber(buf, len, pos, this->height) || this->height <= 0) return false;
+  if(this->format == PPM_FLOAT){
+    //only the sign of the scale matters: negative means little endian
+    float scale;
+    if(!headerFloat(buf, len, pos, scale) || scale == 0.0f) return false;
+    this->littleEndian = scale < 0.0f;
+  } else {
+    if(!headerNumber(buf, len, pos, this->maxVal) || this->maxVal <= 0 || this->maxVal > 65535) return false;
+  }
+  //exactly one whitespace byte separates the header from the pixels
+  if(pos >= len || !isspace(buf[pos])) return false;
+  offset = pos + 1;
+  return true;
+}
+
+size_t ppm::rowBytes(){
+  if(this->format == PPM_FLOAT) return 12 * (size_t)this->width;
+  return 3 * (size_t)this->width * (this->maxVal > 255 ? 2 : 1);
+}
+
+bool ppm::returnEightBit(){
+  return this->format == PPM_BINARY && this->maxVal == 255;
+}
+
+//maps the file and points the pixel view at the payload inside the mapping
+bool ppm::mapData(std::string name){
+  static profileStage* stage = profileStageFor("ppm::mapData");
+  scopedTimer timer(stage);
+#ifdef PPM_MMAP
+  int fd = open(name.c_str(), O_RDONLY);
   //verifies file existence
-  if(!(input.is_open())){
+  if(fd < 0){
     std::cout << "File not found; try excluding the filename extension" << std::endl;
-    exit(EXIT_FAILURE);
+    return false;
+  }
+  struct stat info;
+  if(fstat(fd, &info) != 0 || info.st_size == 0){
+    close(fd);
+    return readData(name);
   }
+  void* map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) return readData(name);
+  //pixels are consumed front to back, so let the kernel read ahead aggressively
+  madvise(map, (size_t)info.st_size, MADV_SEQUENTIAL);
+  size_t offset;
+  const unsigned char* buf = (const unsigned char*)map;
   //verifies file is of right format
-  getline(input, temp);
-  if(temp.compare("P6") != 0){
+  if(!parseHeader(buf, (size_t)info.st_size, offset)){
+    munmap(map, (size_t)info.st_size);
     std::cout << "File not correct format" << std::endl;
-    exit(EXIT_FAILURE);
-  }
-  //parse header
-  while(i < 3){
-    getline(input, temp);
-    //skip commented out lines
-    if(temp.at(0) == '#');
-    else if(i == 1){
-      std::istringstream iss(temp);
-      iss >> this->width;
-      iss >> this->height;
-      i = 2;
+    return false;
+  }
+  if(this->mapping != NULL) munmap(this->mapping, this->mappingSize);
+  this->mapping = NULL;
+  this->view = NULL;
+  this->data = NULL;
+  this->converted.clear();
+  timer.setPixels((long long)this->width * this->height);
+  if(this->format == PPM_ASCII){
+    //text can't be used in place, so the samples are decoded straight out of the mapping
+    size_t count = 3 * (size_t)this->width * this->height, i = 0;
+    this->samples.resize(count);
+    int value;
+    while(i < count && headerNumber(buf, (size_t)info.st_size, offset, value)){
+      this->samples[i++] = (unsigned short)std::min(value, this->maxVal);
     }
-    else if(i == 2){
-      std::istringstream iss(temp);
-      iss >> this->maxVal;
-      i = 3;
+    //a truncated file leaves the rest black
+    std::fill(this->samples.begin() + i, this->samples.end(), 0);
+    munmap(map, (size_t)info.st_size);
+    return true;
+  }
+  if(offset + rowBytes() * this->height > (size_t)info.st_size){
+    munmap(map, (size_t)info.st_size);
+    std::cout << "File is truncated" << std::endl;
+    return false;
+  }
+  this->mapping = map;
+  this->mappingSize = (size_t)info.st_size;
+  this->view = buf + offset;
+  return true;
+#else
+  return readData(name);
+#endif
+}
+
+const unsigned char* ppm::returnView(){
+  if(this->data != NULL) return this->data;
+  if(returnEightBit() || (this->view == NULL && this->samples.empty())) return this->view;
+  //anything but 8 bit pixels is quantized once, on first use
+  if(this->converted.empty()){
+    size_t count = 3 * (size_t)this->width;
+    this->converted.resize(count * this->height);
+    this->lineFloats.resize(count);
+    for(int y = 0; y < this->height; y++){
+      readRow(y, &this->lineFloats[0]);
+      encodeSamples(&this->lineFloats[0], &this->converted[count * y], count, 255);
+    }
+  }
+  return &this->converted[0];
+}
+
+void ppm::readRow(int y, float* out){
+  size_t count = 3 * (size_t)this->width;
+  if(this->format == PPM_ASCII){
+    const unsigned short* in = &this->samples[count * y];
+    const float scale = 1.0f / this->maxVal;
+    for(size_t i = 0; i < count; i++){
+      out[i] = in[i] * scale;
     }
+  } else if(this->format == PPM_FLOAT){
+    //PFM stores the bottom row first
+    copyFloats(this->view + rowBytes() * (this->height - 1 - y), (unsigned char*)out, count, this->littleEndian != hostLittleEndian());
+  } else {
+    const unsigned char* in = (this->data != NULL && returnEightBit()) ? this->data : this->view;
+    decodeSamples(in + rowBytes() * y, out, count, this->maxVal);
   }
-  //remove any remaining whitespace
-  input >> std::ws;
-  //clear array used for loaded data, just in case
-  this->data = new unsigned char[3*this->height*this->width];
-  for(i = 0; i < 3*this->height*this->width; i++){
-    this->data[i] = 0;
+}
+
+//opens name and parses its header, leaving input on the first pixel byte
+bool ppm::readHeader(std::string name){
+  if(this->input.is_open()) this->input.close();
+  this->input.clear();
+  this->input.open(name, std::ifstream::in | std::ifstream::binary);
+  //verifies file existence
+  if(!(this->input.is_open())){
+    std::cout << "File not found; try excluding the filename extension" << std::endl;
+    return false;
   }
-  //load in data and close file
-  input.read((char*)this->data, 3*this->height*this->width);
-  input.close();
-  //used for debugging purposes
-  //writeData("temp");
+  //the header is tokenized in memory; for ASCII files the bytes read past it are the first pixels
+  this->buffer.resize(PPM_HEADER_MAX);
+  this->input.read((char*)&this->buffer[0], PPM_HEADER_MAX);
+  this->bufferLen = (size_t)this->input.gcount();
+  size_t offset;
+  //verifies file is of right format
+  if(!parseHeader(&this->buffer[0], this->bufferLen, offset)){
+    std::cout << "File not correct format" << std::endl;
+    return false;
+  }
+  this->payload = offset;
+  this->bufferPos = offset;
+  this->row = 0;
+  if(this->format != PPM_ASCII){
+    this->input.clear();
+    this->input.seekg(offset);
+  }
+  return true;
 }
-//returns pixel data
+
+//next ASCII sample from the buffered input
+bool ppm::nextSample(int& value){
+  if(this->bufferLen - this->bufferPos < PPM_TOKEN_MAX && this->input){
+    size_t left = this->bufferLen - this->bufferPos;
+    memmove(&this->buffer[0], &this->buffer[this->bufferPos], left);
+    this->buffer.resize(std::max((size_t)PPM_READ_CHUNK, left + PPM_TOKEN_MAX));
+    this->input.read((char*)&this->buffer[left], this->buffer.size() - left);
+    this->bufferLen = left + (size_t)this->input.gcount();
+    this->bufferPos = 0;
+  }
+  return headerNumber(&this->buffer[0], this->bufferLen, this->bufferPos, value);
+}
+
+//loads in image data from filename argument
+bool ppm::readData(std::string name){
+  static profileStage* stage = profileStageFor("ppm::readData");
+  scopedTimer timer(stage);
+  if(!readHeader(name)) return false;
+  timer.setPixels((long long)this->width * this->height);
+  //a mapping from an earlier mapData no longer backs the pixels
+  this->view = NULL;
+  this->data = NULL;
+  this->converted.clear();
+  if(this->format == PPM_ASCII){
+    size_t count = 3 * (size_t)this->width * this->height, i = 0;
+    this->samples.resize(count);
+    int value;
+    while(i < count && nextSample(value)){
+      this->samples[i++] = (unsigned short)std::min(value, this->maxVal);
+    }
+    std::fill(this->samples.begin() + i, this->samples.end(), 0);
+  } else {
+    //load in data and close file; anything missing at the end stays zeroed
+    size_t bytes = rowBytes() * this->height;
+    this->file.resize(bytes);
+    profileAllocation((long long)bytes);
+    this->input.read((char*)&this->file[0], bytes);
+    size_t got = (size_t)this->input.gcount();
+    if(got < bytes) memset(&this->file[got], 0, bytes - got);
+    this->view = &this->file[0];
+  }
+  this->input.close();
+  return true;
+}
+//returns pixel data, copying it out of the mapping if it hasn't been yet
 unsigned char* ppm::returnData(){
+  if(this->data == NULL && (this->view != NULL || !this->samples.empty())){
+    const unsigned char* pixels = returnView();
+    this->data = new unsigned char[3*(size_t)this->height*this->width];
+    memcpy(this->data, pixels, 3*(size_t)this->height*this->width);
+  }
   return this->data;
 }
 //returns image width
@@ -68,21 +423,172 @@ int ppm::returnHeight(){
 int ppm::returnMaxVal(){
   return this->maxVal;
 }
-//used for debugging
-void ppm::writeData(std::string name){
-  std::ofstream out(name, std::ofstream::out | std::ofstream::binary);
-  //write header
-  out << "P6\n" << this->width << " " << this->height << "\n" << this->maxVal << "\n";
-  //write pixel data
-  out.write((char*)this->data, this->width * this->height * 3);
-  //close file
-  out.close();
+
+int ppm::returnFormat(){
+  return this->format;
+}
+//writes the whole image, encoding a row at a time into one buffered write
+bool ppm::writeData(std::string name){
+  static profileStage* stage = profileStageFor("ppm::writeData");
+  scopedTimer timer(stage, (long long)this->width * this->height);
+  size_t count = 3 * (size_t)this->width;
+  beginWrite(name, this->width, this->height);
+  //PFM rows go bottom up, so they are visited in that order to keep the writes sequential
+  bool flip = this->outFormat == PPM_FLOAT;
+  if(this->floatData != NULL){
+    for(int i = 0; i < this->height; i++){
+      this->row = flip ? this->height - 1 - i : i;
+      writeScanline(this->floatData + count * this->row);
+    }
+  } else if(this->data != NULL || returnEightBit()){
+    const unsigned char* pixels = returnView();
+    if(this->outFormat == PPM_BINARY && this->outMaxVal == 255){
+      //nothing to encode
+      this->output.write((const char*)pixels, count * this->height);
+    } else {
+      for(int i = 0; i < this->height; i++){
+        this->row = flip ? this->height - 1 - i : i;
+        writeScanline(pixels + count * this->row);
+      }
+    }
+  } else {
+    //16 bit, ASCII and float pixels read in are passed on as floats, never through 8 bits
+    std::vector<float> pixels(count);
+    for(int i = 0; i < this->height; i++){
+      this->row = flip ? this->height - 1 - i : i;
+      readRow(this->row, &pixels[0]);
+      writeScanline(&pixels[0]);
+    }
+  }
+  return endWrite();
+}
+
+//opens name for reading one scanline at a time; width and height are valid afterwards
+bool ppm::beginRead(std::string name){
+  return readHeader(name);
+}
+//reads the next row; rows past the end of a truncated file come back zeroed
+void ppm::readScanline(unsigned char* out){
+  size_t count = 3 * (size_t)this->width;
+  if(!returnEightBit()){
+    this->lineFloats.resize(count);
+    readScanline(&this->lineFloats[0]);
+    encodeSamples(&this->lineFloats[0], out, count, 255);
+    return;
+  }
+  this->input.read((char*)out, count);
+  if((size_t)this->input.gcount() < count){
+    memset(out + this->input.gcount(), 0, count - this->input.gcount());
+  }
+  this->row++;
+}
+
+void ppm::readScanline(float* out){
+  size_t count = 3 * (size_t)this->width;
+  if(this->format == PPM_ASCII){
+    const float scale = 1.0f / this->maxVal;
+    size_t i = 0;
+    int value;
+    while(i < count && nextSample(value)){
+      out[i++] = std::min(value, this->maxVal) * scale;
+    }
+    for(; i < count; i++){
+      out[i] = 0.0f;
+    }
+  } else {
+    size_t bytes = rowBytes();
+    this->line.resize(bytes);
+    if(this->format == PPM_FLOAT){
+      //rows are read top down, so each one is found from the bottom of the file
+      this->input.clear();
+      this->input.seekg(this->payload + bytes * (this->height - 1 - this->row));
+    }
+    this->input.read((char*)&this->line[0], bytes);
+    size_t got = (size_t)this->input.gcount();
+    if(got < bytes) memset(&this->line[got], 0, bytes - got);
+    if(this->format == PPM_FLOAT) copyFloats(&this->line[0], (unsigned char*)out, count, this->littleEndian != hostLittleEndian());
+    else decodeSamples(&this->line[0], out, count, this->maxVal);
+  }
+  this->row++;
+}
+
+void ppm::endRead(){
+  this->input.close();
+}
+//writes the header for a width x height image; rows follow through writeScanline
+void ppm::beginWrite(std::string name, int width, int height){
+  this->width = width;
+  this->height = height;
+  this->output.open(name, std::ofstream::out | std::ofstream::binary);
+  if(this->outFormat == PPM_FLOAT){
+    //always written little endian
+    this->output << "PF\n" << this->width << " " << this->height << "\n-1.0\n";
+  } else {
+    this->output << (this->outFormat == PPM_ASCII ? "P3\n" : "P6\n") << this->width << " " << this->height << "\n" << this->outMaxVal << "\n";
+  }
+  this->payload = (size_t)this->output.tellp();
+  this->outputPos = this->payload;
+  this->row = 0;
+}
+
+void ppm::writeScanline(const unsigned char* in){
+  size_t count = 3 * (size_t)this->width;
+  if(this->outFormat == PPM_BINARY && this->outMaxVal == 255){
+    this->output.write((const char*)in, count);
+    this->row++;
+    return;
+  }
+  this->lineFloats.resize(count);
+  for(size_t i = 0; i < count; i++){
+    this->lineFloats[i] = in[i] * (1.0f / 255.0f);
+  }
+  writeScanline(&this->lineFloats[0]);
+}
+
+void ppm::writeScanline(const float* in){
+  size_t count = 3 * (size_t)this->width;
+  unsigned char* end;
+  if(this->outFormat == PPM_ASCII){
+    //at most five digits and a separator per sample
+    this->line.resize(6 * count);
+    end = &this->line[0];
+    const float top = (float)this->outMaxVal;
+    for(size_t i = 0; i < count; i++){
+      bool last = i + 1 == count || (i + 1) % PPM_ASCII_LINE == 0;
+      end = writeSample(end, quantize(in[i], top), last ? '\n' : ' ');
+    }
+  } else if(this->outFormat == PPM_FLOAT){
+    this->line.resize(4 * count);
+    copyFloats((const unsigned char*)in, &this->line[0], count, !hostLittleEndian());
+    end = &this->line[0] + 4 * count;
+    size_t pos = this->payload + 4 * count * (this->height - 1 - this->row);
+    if(pos != this->outputPos) this->output.seekp(pos);
+    this->outputPos = pos + 4 * count;
+  } else {
+    size_t bytes = count * (this->outMaxVal > 255 ? 2 : 1);
+    this->line.resize(bytes);
+    encodeSamples(in, &this->line[0], count, this->outMaxVal);
+    end = &this->line[0] + bytes;
+  }
+  this->output.write((const char*)&this->line[0], end - &this->line[0]);
+  this->row++;
+}
+
+bool ppm::endWrite(){
+  //an output that never opened, or a write that failed, leaves the stream failed
+  bool written = this->output.is_open() && this->output.good();
+  this->output.close();
+  return written && !this->output.fail();
 }
 
 void ppm::setData(unsigned char* data){
   this->data = data;
 }
 
+void ppm::setFloatData(const float* data){
+  this->floatData = data;
+}
+
 void ppm::setWidth(int width){
   this->width = width;
 }
@@ -90,3 +596,8 @@ void ppm::setWidth(int width){
 void ppm::setHeight(int height){
   this->height = height;
 }
+
+void ppm::setFormat(int format, int maxVal){
+  this->outFormat = format;
+  this->outMaxVal = std::max(1, std::min(65535, maxVal));
+}
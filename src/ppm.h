@@ -8,23 +8,115 @@
 #include <cstdlib>
 #include <iostream>
 #include <sstream>
+#include <vector>
 
+//file layouts ppm reads and writes (setFormat picks the one written)
+//binary P6; samples are 16 bit big endian when maxVal is over 255
+#define PPM_BINARY 0
+//ASCII P3
+#define PPM_ASCII 1
+//PFM colour ("PF"), 32 bit floats with 1.0 as white, rows stored bottom up
+#define PPM_FLOAT 2
+
+//
+// Portable pixmaps: binary (8 or 16 bit) and ASCII ppm, and PFM. The header
+// is tokenized in one pass over the bytes, so every field may share a line
+// and comments may appear between any two of them. Pixels can be read and
+// written whole (readData/mapData, writeData) or a scanline at a time, as
+// 8 bit RGB or as floats where 1.0 is maxVal, so 16 bit and PFM images pass
+// through without being quantized.
+//
 class ppm {
   private:
     unsigned char* data;
+    //float pixels to write, set by setFloatData
+    const float* floatData;
     int width;
     int height;
     int maxVal;
+    int format;
+    //layout writeData and beginWrite produce
+    int outFormat;
+    int outMaxVal;
+    //PFM byte order, from the sign of the scale in its header
+    bool littleEndian;
+    //read-only file mapping set up by mapData
+    void* mapping;
+    size_t mappingSize;
+    //stored pixels of a binary file, in the mapping or in file
+    const unsigned char* view;
+    //the pixels read by readData
+    std::vector<unsigned char> file;
+    //samples of an ASCII image, 0 to maxVal
+    std::vector<unsigned short> samples;
+    //8 bit copy of pixels stored any other way, made the first time returnView is called
+    std::vector<unsigned char> converted;
+    bool parseHeader(const unsigned char* buf, size_t len, size_t& offset);
+    //bytes per stored row of a binary image
+    size_t rowBytes();
+    //open files for the scanline interface
+    std::ifstream input;
+    std::ofstream output;
+    //buffered input for ASCII scanlines; header bytes read past the pixels' start
+    std::vector<unsigned char> buffer;
+    size_t bufferPos;
+    size_t bufferLen;
+    //offset of the first pixel byte, and the next row the scanline interface reads or writes
+    size_t payload;
+    int row;
+    size_t outputPos;
+    //encoded bytes of the row being written
+    std::vector<unsigned char> line;
+    std::vector<float> lineFloats;
+    bool readHeader(std::string name);
+    bool nextSample(int& value);
   public:
     ppm();
-    void readData(std::string name);
-    void writeData(std::string name);
+    //unmaps the file mapData mapped, so a copy would unmap it twice
+    ~ppm();
+    ppm(const ppm&) = delete;
+    ppm& operator=(const ppm&) = delete;
+    //false, after printing why, if the file can't be opened or isn't a ppm or PFM
+    bool readData(std::string name);
+    //maps the file instead of reading it (falls back to readData where mmap isn't available); false as for readData
+    bool mapData(std::string name);
+    //writes the image in the layout set by setFormat, from setFloatData, setData or the pixels read, in that order
+    //false if the file couldn't be opened or written
+    bool writeData(std::string name);
+    //opens name and parses its header; width and height are valid afterwards. false, after printing why, if it can't
+    bool beginRead(std::string name);
+    //reads the next scanline as 3 * width bytes, quantizing anything that isn't 8 bit
+    void readScanline(unsigned char* out);
+    //reads the next scanline as 3 * width floats, 1.0 = maxVal
+    void readScanline(float* out);
+    void endRead();
+    //writes the header for a width x height image
+    void beginWrite(std::string name, int width, int height);
+    //writes 3 * width bytes as the next scanline
+    void writeScanline(const unsigned char* in);
+    //writes 3 * width floats (1.0 = white) as the next scanline
+    void writeScanline(const float* in);
+    //closes the file; false if it never opened or any write failed
+    bool endWrite();
+    //read-only 8 bit pixels; points into the mapping after mapData when the file is 8 bit
+    const unsigned char* returnView();
+    //writable pixels; a mapped image is copied out of the mapping the first time this is called
     unsigned char* returnData();
+    //copies row y of a loaded image as 3 * width floats, 1.0 = maxVal
+    void readRow(int y, float* out);
+    //true when the pixels are 8 bit with a maxVal of 255, so returnView converts nothing
+    bool returnEightBit();
     int returnWidth();
     int returnHeight();
+    //maxVal and layout of the file read
     int returnMaxVal();
+    int returnFormat();
     void setData(unsigned char* data);
+    //3 * width floats per row, 1.0 = white; used by writeData instead of setData's pixels
+    void setFloatData(const float* data);
     void setWidth(int width);
     void setHeight(int height);
+    //layout to write (PPM_BINARY and 255 unless set); binary samples are 16 bit when maxVal is over 255
+    void setFormat(int format, int maxVal);
 };
 #endif
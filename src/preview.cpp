@@ -0,0 +1,51 @@
+#include "preview.h"
+
+//smallest side kept in the pyramid
+#define PYRAMID_MIN_SIZE 16
+
+previewPipeline::previewPipeline() : graph(&buffers){
+  this->level = 0;
+}
+
+void previewPipeline::build(const planarImage* source){
+  this->pyramid.build(source, PYRAMID_MIN_SIZE);
+  this->level = this->pyramid.chooseLevel(PREVIEW_PIXELS);
+  if(this->level == 0) return;
+  this->buffers.resize(this->pyramid.returnWidth(this->level), this->pyramid.returnHeight(this->level));
+  *this->buffers.returnSource() = *this->pyramid.returnLevel(this->level);
+  this->graph.setSource();
+}
+
+bool previewPipeline::enabled(){
+  return this->level > 0;
+}
+
+void previewPipeline::setTone(float gamma, float gain, float bias){
+  this->graph.setTone(gamma, gain, bias);
+}
+
+void previewPipeline::setToneOperator(int op, bool autoExposure){
+  this->graph.setToneOperator(op, autoExposure);
+}
+
+void previewPipeline::setFilter(int radius, int type){
+  //the kernel covers the same part of the picture at every level
+  int scaled = (radius + (1 << this->level) / 2) >> this->level;
+  this->graph.setFilter(scaled < 1 ? 1 : scaled, type);
+}
+
+bool previewPipeline::evaluate(){
+  return this->graph.evaluate();
+}
+
+unsigned char* previewPipeline::returnPixels(){
+  return this->buffers.returnDisplay();
+}
+
+int previewPipeline::returnWidth(){
+  return this->buffers.returnWidth();
+}
+
+int previewPipeline::returnHeight(){
+  return this->buffers.returnHeight();
+}
@@ -0,0 +1,40 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "framebuffer.h"
+#include "graph.h"
+#include "pyramid.h"
+
+//largest preview that still filters and tone maps well inside a 16 ms frame
+#define PREVIEW_PIXELS (640 * 360)
+
+//
+// Downsampled copy of the processing graph used for progressive editing:
+// edits are applied to a level of a mip pyramid (radius scaled to match)
+// so they show up right away, while the full resolution graph catches up
+// later (see renderThread).
+//
+class previewPipeline {
+  private:
+    mipPyramid pyramid;
+    int level;
+    frameBuffers buffers;
+    processingGraph graph;
+  public:
+    previewPipeline();
+    //builds the pyramid from the full resolution source; call once after loading
+    void build(const planarImage* source);
+    //false when the image is small enough to edit at full resolution directly
+    bool enabled();
+    void setTone(float gamma, float gain, float bias);
+    void setToneOperator(int op, bool autoExposure);
+    //radius is in full resolution pixels
+    void setFilter(int radius, int type);
+    //brings the preview frame up to date; returns true if it changed
+    bool evaluate();
+    unsigned char* returnPixels();
+    int returnWidth();
+    int returnHeight();
+};
+
+#endif
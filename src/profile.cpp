@@ -0,0 +1,194 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#define PROFILE_BUCKETS (PROFILE_OCTAVES * PROFILE_BUCKETS_PER_OCTAVE + 1)
+
+static std::atomic<bool> enabled(false);
+static std::atomic<bool> tracing(false);
+
+//every stage created so far, in creation order
+static std::mutex registryLock;
+static std::vector<std::unique_ptr<profileStage> > stages;
+
+//one finished timer, for the trace
+struct traceEvent {
+  profileStage* stage;
+  int thread;
+  double start;
+  double duration;
+};
+static std::mutex traceLock;
+static std::vector<traceEvent> events;
+
+//trace timestamps count from here
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+//innermost running timer's stage on this thread, and a small id for the thread in the trace
+static thread_local profileStage* current = NULL;
+static thread_local int threadIndex = -1;
+static std::atomic<int> nextThread(0);
+
+//bucket 0 is anything under a microsecond; bucket i covers [2^((i - 1) / n), 2^(i / n)) microseconds
+static int bucketFor(double seconds){
+  double micro = seconds * 1e6;
+  if(micro < 1.0) return 0;
+  int i = 1 + (int)(log2(micro) * PROFILE_BUCKETS_PER_OCTAVE);
+  return std::min(i, PROFILE_BUCKETS - 1);
+}
+
+static double bucketTop(int i){
+  return pow(2.0, (double)i / PROFILE_BUCKETS_PER_OCTAVE) * 1e-6;
+}
+
+profileStage::profileStage(const std::string& name){
+  this->name = name;
+  this->count = 0;
+  this->total = 0.0;
+  this->shortest = 0.0;
+  this->longest = 0.0;
+  this->pixels = 0;
+  this->bytes = 0;
+  std::fill(this->buckets, this->buckets + PROFILE_BUCKETS, 0);
+}
+
+void profileStage::record(double seconds, long long pixels){
+  std::unique_lock<std::mutex> guard(this->lock);
+  if(this->count == 0 || seconds < this->shortest) this->shortest = seconds;
+  if(this->count == 0 || seconds > this->longest) this->longest = seconds;
+  this->count++;
+  this->total = this->total + seconds;
+  this->pixels = this->pixels + pixels;
+  this->buckets[bucketFor(seconds)]++;
+}
+
+void profileStage::allocated(long long bytes){
+  std::unique_lock<std::mutex> guard(this->lock);
+  this->bytes = this->bytes + bytes;
+}
+
+const std::string& profileStage::returnName(){
+  return this->name;
+}
+
+void profileStage::writeSummary(std::string& out){
+  std::unique_lock<std::mutex> guard(this->lock);
+  //p99 is the top of the bucket holding the 99th percentile run, clamped to what was actually seen
+  double p99 = 0.0;
+  long long wanted = (long long)ceil(0.99 * this->count), seen = 0;
+  for(int i = 0; i < PROFILE_BUCKETS && this->count > 0; i++){
+    seen = seen + this->buckets[i];
+    if(seen >= wanted){
+      p99 = std::max(this->shortest, std::min(this->longest, bucketTop(i)));
+      break;
+    }
+  }
+  char line[512];
+  snprintf(line, sizeof(line),
+           "{\"stage\": \"%s\", \"count\": %lld, \"min_ms\": %.4f, \"mean_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f, "
+           "\"total_ms\": %.4f, \"pixels\": %lld, \"bytes_allocated\": %lld}",
+           this->name.c_str(), this->count, this->shortest * 1e3, this->count > 0 ? this->total * 1e3 / this->count : 0.0,
+           p99 * 1e3, this->longest * 1e3, this->total * 1e3, this->pixels, this->bytes);
+  out += line;
+}
+
+scopedTimer::scopedTimer(profileStage* stage, long long pixels){
+  this->active = enabled.load(std::memory_order_relaxed);
+  if(!this->active) return;
+  this->stage = stage;
+  this->pixels = pixels;
+  this->outer = current;
+  current = stage;
+  this->start = std::chrono::steady_clock::now();
+}
+
+scopedTimer::~scopedTimer(){
+  if(!this->active) return;
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - this->start).count();
+  this->stage->record(seconds, this->pixels);
+  current = this->outer;
+  if(tracing.load(std::memory_order_relaxed)){
+    if(threadIndex < 0) threadIndex = nextThread++;
+    traceEvent event;
+    event.stage = this->stage;
+    event.thread = threadIndex;
+    event.start = std::chrono::duration<double>(this->start - epoch).count();
+    event.duration = seconds;
+    std::unique_lock<std::mutex> guard(traceLock);
+    if(events.size() < PROFILE_TRACE_MAX) events.push_back(event);
+  }
+}
+
+void scopedTimer::setPixels(long long pixels){
+  this->pixels = pixels;
+}
+
+profileStage* profileStageFor(const char* name){
+  std::unique_lock<std::mutex> guard(registryLock);
+  for(size_t i = 0; i < stages.size(); i++){
+    if(stages[i]->returnName() == name) return stages[i].get();
+  }
+  stages.push_back(std::unique_ptr<profileStage>(new profileStage(name)));
+  return stages.back().get();
+}
+
+void setProfiling(bool on, bool trace){
+  enabled = on;
+  tracing = on && trace;
+}
+
+bool profiling(){
+  return enabled;
+}
+
+void profileAllocation(long long bytes){
+  if(current != NULL) current->allocated(bytes);
+}
+
+bool writeProfile(std::string name){
+  std::string out = "[\n";
+  {
+    std::unique_lock<std::mutex> guard(registryLock);
+    for(size_t i = 0; i < stages.size(); i++){
+      out += "  ";
+      stages[i]->writeSummary(out);
+      out += (i + 1 < stages.size()) ? ",\n" : "\n";
+    }
+  }
+  out += "]\n";
+  std::ofstream file(name.c_str(), std::ios::binary);
+  if(!file.is_open()){
+    std::cout << "Can't write profile " << name << std::endl;
+    return false;
+  }
+  file << out;
+  return (bool)file;
+}
+
+bool writeTrace(std::string name){
+  std::ofstream file(name.c_str(), std::ios::binary);
+  if(!file.is_open()){
+    std::cout << "Can't write trace " << name << std::endl;
+    return false;
+  }
+  std::unique_lock<std::mutex> guard(traceLock);
+  //complete ("X") events, timestamps and durations in microseconds
+  file << "{\"traceEvents\": [\n";
+  char line[256];
+  for(size_t i = 0; i < events.size(); i++){
+    const traceEvent& e = events[i];
+    snprintf(line, sizeof(line), "  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}%s\n",
+             e.stage->returnName().c_str(), e.thread, e.start * 1e6, e.duration * 1e6, (i + 1 < events.size()) ? "," : "");
+    file << line;
+  }
+  file << "]}\n";
+  return (bool)file;
+}
@@ -0,0 +1,95 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+
+//each doubling of duration is split into this many histogram buckets (about 9% apart)
+#define PROFILE_BUCKETS_PER_OCTAVE 8
+//doublings above one microsecond the histograms resolve; anything longer lands in the last bucket
+#define PROFILE_OCTAVES 32
+//trace events kept at most, so a long session can't grow without bound
+#define PROFILE_TRACE_MAX 1000000
+
+//
+// Timings and counters for one named pipeline stage (convolution, tone map,
+// texture upload, file I/O, ...). Durations go into a log scale histogram,
+// so min/mean/max are exact and percentiles are accurate to one bucket.
+// Stages are created by profileStageFor() and live for the whole run.
+//
+class profileStage {
+  private:
+    std::string name;
+    std::mutex lock;
+    long long count;
+    double total;
+    double shortest;
+    double longest;
+    long long pixels;
+    long long bytes;
+    long long buckets[PROFILE_OCTAVES * PROFILE_BUCKETS_PER_OCTAVE + 1];
+  public:
+    profileStage(const std::string& name);
+    //one run of the stage that took seconds and processed pixels
+    void record(double seconds, long long pixels);
+    //bytes of image memory the stage allocated
+    void allocated(long long bytes);
+    const std::string& returnName();
+    //appends the stage's summary as one JSON object
+    void writeSummary(std::string& out);
+};
+
+//
+// Times the enclosing scope as one run of stage. Costs one flag check when
+// profiling is off. Timers nest: allocations reported through
+// profileAllocation() go to the innermost timer on the same thread.
+//
+//   static profileStage* stage = profileStageFor("convolution");
+//   scopedTimer timer(stage, width * height);
+//
+class scopedTimer {
+  private:
+    profileStage* stage;
+    profileStage* outer;
+    long long pixels;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+  public:
+    scopedTimer(profileStage* stage, long long pixels = 0);
+    ~scopedTimer();
+    //for stages that only learn how many pixels they handle part way through
+    void setPixels(long long pixels);
+    scopedTimer(const scopedTimer&) = delete;
+    scopedTimer& operator=(const scopedTimer&) = delete;
+};
+
+//the stage with this name, created on first use
+profileStage* profileStageFor(const char* name);
+
+//turns the timers on or off (off by default); tracing also keeps every event for writeTrace
+void setProfiling(bool on, bool trace);
+bool profiling();
+
+//charges bytes of newly allocated image memory to the innermost running timer on this thread
+void profileAllocation(long long bytes);
+
+//
+// Writes every stage's count, min/mean/p99/max milliseconds, pixels and
+// allocated bytes as a JSON array.
+//
+// \param name file to write
+// \return false if the file couldn't be written
+//
+bool writeProfile(std::string name);
+
+//
+// Writes the recorded events in Chrome's trace event format (load it in
+// chrome://tracing or Perfetto). Needs setProfiling(true, true).
+//
+// \param name file to write
+// \return false if the file couldn't be written
+//
+bool writeTrace(std::string name);
+
+#endif
@@ -0,0 +1,66 @@
+#include "pyramid.h"
+#include "threadpool.h"
+#include "profile.h"
+
+void downsample(const planarImage& src, planarImage& dst){
+  int width = src.returnWidth(), height = src.returnHeight();
+  int outWidth = (width + 1) / 2, outHeight = (height + 1) / 2;
+  dst.resize(outWidth, outHeight);
+  sharedPool()->parallelFor(3 * outHeight, [&](int t){
+    int c = t / outHeight, y = t % outHeight;
+    //odd sizes repeat the last row or column
+    const float* row0 = src.returnRow(c, 2 * y);
+    const float* row1 = src.returnRow(c, (2 * y + 1 < height) ? 2 * y + 1 : 2 * y);
+    float* out = dst.returnRow(c, y);
+    for(int x = 0; x < width / 2; x++){
+      out[x] = 0.25f * (row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1]);
+    }
+    if(width % 2 == 1){
+      int x = width - 1;
+      out[outWidth - 1] = 0.25f * (row0[x] + row0[x] + row1[x] + row1[x]);
+    }
+  });
+}
+
+mipPyramid::mipPyramid(){
+  this->base = NULL;
+}
+
+void mipPyramid::build(const planarImage* source, int minSize){
+  static profileStage* stage = profileStageFor("mipPyramid::build");
+  scopedTimer timer(stage, (long long)source->returnWidth() * source->returnHeight());
+  this->base = source;
+  //level 0 is never stored, so keep an empty placeholder for it
+  this->levels.assign(1, planarImage());
+  int width = source->returnWidth(), height = source->returnHeight();
+  while(width / 2 >= minSize && height / 2 >= minSize){
+    this->levels.push_back(planarImage());
+    downsample(*returnLevel((int)this->levels.size() - 2), this->levels.back());
+    width = this->levels.back().returnWidth();
+    height = this->levels.back().returnHeight();
+  }
+}
+
+int mipPyramid::returnLevels(){
+  return (int)this->levels.size();
+}
+
+const planarImage* mipPyramid::returnLevel(int level){
+  if(level == 0) return this->base;
+  return &this->levels[level];
+}
+
+int mipPyramid::returnWidth(int level){
+  return returnLevel(level)->returnWidth();
+}
+
+int mipPyramid::returnHeight(int level){
+  return returnLevel(level)->returnHeight();
+}
+
+int mipPyramid::chooseLevel(int maxPixels){
+  for(int i = 0; i < returnLevels(); i++){
+    if(returnWidth(i) * returnHeight(i) <= maxPixels) return i;
+  }
+  return returnLevels() - 1;
+}
@@ -0,0 +1,31 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include "image.h"
+
+#include <vector>
+
+//
+// Mip pyramid of a planar RGB image. Level 0 is the source itself (not
+// copied); each further level halves both sides with a 2x2 box average,
+// stopping once a side would drop below minSize.
+//
+class mipPyramid {
+  private:
+    std::vector<planarImage> levels;
+    const planarImage* base;
+  public:
+    mipPyramid();
+    void build(const planarImage* source, int minSize);
+    int returnLevels();
+    const planarImage* returnLevel(int level);
+    int returnWidth(int level);
+    int returnHeight(int level);
+    //finest level with at most maxPixels pixels (the coarsest level if none fit)
+    int chooseLevel(int maxPixels);
+};
+
+//averages 2x2 blocks of src into dst, which is resized to ((width + 1) / 2) x ((height + 1) / 2)
+void downsample(const planarImage& src, planarImage& dst);
+
+#endif
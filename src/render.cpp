@@ -0,0 +1,261 @@
+#include "render.h"
+#include "imagecache.h"
+#include "profile.h"
+
+#include <chrono>
+#include <cstring>
+
+//bit marking the middle frame as not yet read
+#define FRAME_FRESH 4u
+
+paramMailbox::paramMailbox(){
+  this->pending = false;
+  this->closed = false;
+}
+
+void paramMailbox::post(const renderParams& params){
+  {
+    std::unique_lock<std::mutex> guard(this->lock);
+    this->latest = params;
+    this->pending = true;
+  }
+  this->posted.notify_one();
+}
+
+bool paramMailbox::take(renderParams& params, int timeoutMs){
+  std::unique_lock<std::mutex> guard(this->lock);
+  if(timeoutMs < 0){
+    while(!this->pending && !this->closed){
+      this->posted.wait(guard);
+    }
+  } else {
+    std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while(!this->pending && !this->closed){
+      if(this->posted.wait_until(guard, until) == std::cv_status::timeout) break;
+    }
+  }
+  if(!this->pending) return false;
+  params = this->latest;
+  this->pending = false;
+  return true;
+}
+
+bool paramMailbox::waiting(){
+  std::unique_lock<std::mutex> guard(this->lock);
+  return this->pending;
+}
+
+bool paramMailbox::returnClosed(){
+  std::unique_lock<std::mutex> guard(this->lock);
+  return this->closed;
+}
+
+void paramMailbox::close(){
+  {
+    std::unique_lock<std::mutex> guard(this->lock);
+    this->closed = true;
+  }
+  this->posted.notify_all();
+}
+
+frameExchange::frameExchange(){
+  this->back = 0;
+  this->middle = 1;
+  this->front = 2;
+}
+
+renderFrame* frameExchange::returnBack(){
+  return &this->frames[this->back];
+}
+
+void frameExchange::publish(){
+  unsigned old = this->middle.exchange((unsigned)this->back | FRAME_FRESH);
+  this->back = (int)(old & 3u);
+}
+
+const renderFrame* frameExchange::consume(){
+  if(!(this->middle.load() & FRAME_FRESH)) return NULL;
+  unsigned old = this->middle.exchange((unsigned)this->front);
+  this->front = (int)(old & 3u);
+  return &this->frames[this->front];
+}
+
+textureShadow::textureShadow(){
+  this->width = 0;
+  this->height = 0;
+}
+
+bool textureShadow::update(const unsigned char* frame, int width, int height, int& top, int& bottom){
+  size_t row = 3 * (size_t)width;
+  top = 0;
+  bottom = height;
+  if(width == this->width && height == this->height){
+    //trim the unchanged rows off both ends
+    while(top < bottom && memcmp(&this->pixels[row * top], frame + row * top, row) == 0) top++;
+    while(bottom > top && memcmp(&this->pixels[row * (bottom - 1)], frame + row * (bottom - 1), row) == 0) bottom--;
+    if(top < bottom) memcpy(&this->pixels[row * top], frame + row * top, row * (bottom - top));
+  } else {
+    this->pixels.assign(frame, frame + row * height);
+    this->width = width;
+    this->height = height;
+  }
+  return top < bottom;
+}
+
+void applyParams(processingGraph* graph, const renderParams& params){
+  if(params.toneSet){
+    graph->setTone(params.gamma, params.gain, params.bias);
+    graph->setToneOperator(params.op, params.autoExposure);
+  }
+  if(params.filterSet) graph->setFilter(params.radius, params.type);
+}
+
+bool loadSource(processingGraph* graph, previewPipeline* preview, frameBuffers* buffers, const planarImage& source, const renderParams& params){
+  buffers->resize(source.returnWidth(), source.returnHeight());
+  *buffers->returnSource() = source;
+  graph->setSource();
+  if(preview != NULL) preview->build(buffers->returnSource());
+  if(params.toneSet || params.filterSet) return false;
+  if(source.returnEightBit()){
+    source.toRGB24(buffers->returnDisplay());
+  } else {
+    //an HDR source has nothing to show without a tone curve
+    graph->setTone(params.gamma, params.gain, params.bias);
+    graph->setToneOperator(params.op, params.autoExposure);
+    graph->evaluate();
+  }
+  return true;
+}
+
+renderThread::renderThread(processingGraph* full, previewPipeline* preview, frameBuffers* buffers, imageCache* cache, int first){
+  this->full = full;
+  this->preview = preview;
+  this->buffers = buffers;
+  this->cache = cache;
+  this->shown = first;
+  this->current.gamma = this->current.gain = this->current.bias = 1.0f;
+  this->current.op = TONE_POWER;
+  this->current.autoExposure = false;
+  this->current.radius = 1;
+  this->current.type = 0;
+  this->current.image = first;
+  this->current.toneSet = false;
+  this->current.filterSet = false;
+  this->current.serial = 0;
+}
+
+renderThread::~renderThread(){
+  stop();
+}
+
+void renderThread::setNotify(const std::function<void()>& fn){
+  this->notify = fn;
+}
+
+void renderThread::start(){
+  this->worker = std::thread(&renderThread::run, this);
+}
+
+void renderThread::stop(){
+  if(!this->worker.joinable()) return;
+  this->mailbox.close();
+  this->worker.join();
+  //whatever was still pending or only previewed ends up in the full frame
+  applyParams(this->full, this->current);
+  if(this->current.toneSet || this->current.filterSet) this->full->evaluate();
+}
+
+void renderThread::post(const renderParams& params){
+  this->mailbox.post(params);
+}
+
+const renderFrame* renderThread::takeFrame(){
+  return this->exchange.consume();
+}
+
+void renderThread::publish(const unsigned char* pixels, int width, int height, bool full){
+  static profileStage* stage = profileStageFor("render::publish");
+  scopedTimer timer(stage, (long long)width * height);
+  renderFrame* frame = this->exchange.returnBack();
+  frame->pixels.resize(3 * width * height);
+  memcpy(&frame->pixels[0], pixels, 3 * width * height);
+  frame->width = width;
+  frame->height = height;
+  frame->imageWidth = full ? width : this->buffers->returnWidth();
+  frame->imageHeight = full ? height : this->buffers->returnHeight();
+  frame->full = full;
+  frame->serial = this->current.serial;
+  this->exchange.publish();
+  if(this->notify) this->notify();
+}
+
+bool renderThread::switchImage(){
+  static profileStage* stage = profileStageFor("render::switch");
+  scopedTimer timer(stage);
+  int previous = this->shown;
+  this->shown = this->current.image;
+  //the last output made with these settings can go up before the source is even loaded
+  std::shared_ptr<const std::vector<unsigned char> > output;
+  bool edited = this->current.toneSet || this->current.filterSet;
+  int width = 0, height = 0;
+  if(edited) output = this->cache->findOutput(this->shown, this->current, width, height);
+  if(output) publish(&(*output)[0], width, height, true);
+  std::shared_ptr<const planarImage> source = this->cache->acquire(this->shown);
+  //an input that can't be decoded leaves the previous image up, processed with the new settings (it never has an output)
+  if(!source){
+    this->shown = previous;
+    return false;
+  }
+  timer.setPixels((long long)source->returnWidth() * source->returnHeight());
+  if(loadSource(this->full, this->preview, this->buffers, *source, this->current)){
+    publish(this->buffers->returnDisplay(), source->returnWidth(), source->returnHeight(), true);
+    return true;
+  }
+  return (bool)output;
+}
+
+void renderThread::run(){
+  bool fullStale = false;
+  while(true){
+    renderParams params;
+    if(this->mailbox.take(params, fullStale ? REFINE_IDLE_MS : -1)){
+      this->current = params;
+      if(params.image != this->shown && switchImage()){
+        fullStale = false;
+        continue;
+      }
+      if(this->preview != NULL && this->preview->enabled()){
+        if(params.toneSet){
+          this->preview->setTone(params.gamma, params.gain, params.bias);
+          this->preview->setToneOperator(params.op, params.autoExposure);
+        }
+        if(params.filterSet) this->preview->setFilter(params.radius, params.type);
+        static profileStage* previewStage = profileStageFor("render::preview");
+        scopedTimer timer(previewStage, (long long)this->preview->returnWidth() * this->preview->returnHeight());
+        if(this->preview->evaluate()){
+          publish(this->preview->returnPixels(), this->preview->returnWidth(), this->preview->returnHeight(), false);
+        }
+        fullStale = true;
+        continue;
+      }
+    } else if(this->mailbox.returnClosed()){
+      //stop() finishes the full frame itself
+      return;
+    }
+    applyParams(this->full, this->current);
+    int width = this->buffers->returnWidth(), height = this->buffers->returnHeight();
+    static profileStage* fullStage = profileStageFor("render::full");
+    scopedTimer timer(fullStage, (long long)width * height);
+    bool changed = this->full->evaluate();
+    fullStale = false;
+    //a frame that is already out of date would only flash older settings over the preview
+    if(this->mailbox.waiting()){
+      fullStale = true;
+      continue;
+    }
+    if(changed){
+      publish(this->buffers->returnDisplay(), width, height, true);
+      this->cache->storeOutput(this->shown, this->buffers->returnDisplay(), width, height, this->current);
+    }
+  }
+}
@@ -0,0 +1,169 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "graph.h"
+#include "preview.h"
+#include "framebuffer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class imageCache;
+
+//how long edits have to pause before the full resolution frame is rebuilt
+#define REFINE_IDLE_MS 150
+
+//everything the viewer's keys control
+struct renderParams {
+  float gamma;
+  float gain;
+  float bias;
+  //tone operator (TONE_POWER and the rest), and whether gain and bias are measured from the image
+  int op;
+  bool autoExposure;
+  int radius;
+  int type;
+  //which of the viewer's inputs is shown (see imageCache)
+  int image;
+  //false until the matching keys are first pressed
+  bool toneSet;
+  bool filterSet;
+  //counts the posts, so a frame can be matched to the parameters it was made with (see sessionPlayer)
+  unsigned serial;
+};
+
+//
+// Single slot the event loop drops parameters into. Posting overwrites
+// whatever hasn't been picked up yet, so a burst of key repeats turns into
+// one recompute with the newest values.
+//
+class paramMailbox {
+  private:
+    std::mutex lock;
+    std::condition_variable posted;
+    renderParams latest;
+    bool pending;
+    bool closed;
+  public:
+    paramMailbox();
+    void post(const renderParams& params);
+    //waits up to timeoutMs (forever if negative) for new parameters; false on timeout or close
+    bool take(renderParams& params, int timeoutMs);
+    //true if parameters were posted that haven't been taken yet
+    bool waiting();
+    void close();
+    bool returnClosed();
+};
+
+//a finished RGB24 frame
+struct renderFrame {
+  std::vector<unsigned char> pixels;
+  int width;
+  int height;
+  //size of the image shown, which a preview frame is a downsampled copy of
+  int imageWidth;
+  int imageHeight;
+  //false for a downsampled preview frame
+  bool full;
+  //serial of the parameters the frame was made with
+  unsigned serial;
+};
+
+//
+// Lock-free triple buffer: the render thread fills the back frame and swaps
+// it into the middle, the event loop swaps the middle out to read it. Neither
+// side ever waits, and a frame that is replaced before being read is dropped.
+//
+class frameExchange {
+  private:
+    renderFrame frames[3];
+    int back;
+    int front;
+    //index of the middle frame, plus FRESH when it hasn't been read yet
+    std::atomic<unsigned> middle;
+  public:
+    frameExchange();
+    renderFrame* returnBack();
+    void publish();
+    //newest published frame, or NULL if nothing new arrived since the last call
+    const renderFrame* consume();
+};
+
+//
+// What was last uploaded to one texture. The viewer runs every new frame
+// through update() and only re-uploads the band of rows that changed, so a
+// frame identical to the one on screen (or one that only touched a few rows)
+// costs next to nothing to show. Kept on the viewer's side rather than the
+// render thread's because frames can be dropped before they are read.
+//
+class textureShadow {
+  private:
+    std::vector<unsigned char> pixels;
+    int width;
+    int height;
+  public:
+    textureShadow();
+    //records a width x height RGB24 frame as uploaded; rows [top, bottom) are what changed, false if nothing did
+    bool update(const unsigned char* frame, int width, int height, int& top, int& bottom);
+};
+
+//
+// Runs the processing graphs on their own thread so the event loop never
+// blocks on filtering. Each new set of parameters is applied to the preview
+// (when the image is large enough to have one) and published at once; the
+// full resolution frame follows after REFINE_IDLE_MS without new input, and
+// is only published if no newer parameters arrived while it was computed.
+// Finished full frames are stored in the image cache, so switching to an
+// image whose last output used the current settings publishes that output
+// straight away; otherwise the new source is loaded into the graphs and
+// goes through the preview like an edit. The graphs and buffers must not be
+// used by anyone else between start() and stop().
+//
+class renderThread {
+  private:
+    processingGraph* full;
+    previewPipeline* preview;
+    frameBuffers* buffers;
+    imageCache* cache;
+    //image loaded into the graphs
+    int shown;
+    paramMailbox mailbox;
+    frameExchange exchange;
+    std::thread worker;
+    renderParams current;
+    std::function<void()> notify;
+    void run();
+    void publish(const unsigned char* pixels, int width, int height, bool full);
+    //loads the current image into the graphs; true if its finished frame was already published
+    bool switchImage();
+  public:
+    //the graphs work on buffers, whose source already holds image first of cache
+    renderThread(processingGraph* full, previewPipeline* preview, frameBuffers* buffers, imageCache* cache, int first);
+    ~renderThread();
+    //fn runs on the render thread after every published frame (the viewer uses it to wake its event loop); set before start()
+    void setNotify(const std::function<void()>& fn);
+    void start();
+    //stops the thread; the full graph is brought up to the last posted parameters first
+    void stop();
+    void post(const renderParams& params);
+    const renderFrame* takeFrame();
+};
+
+//sets the graph's stages from params
+void applyParams(processingGraph* graph, const renderParams& params);
+
+//
+// Makes source the image the graph (through buffers) and preview work on.
+// Before the first edit, when params has neither tone nor filter set, the
+// display frame is brought up to date here: 8 bit sources are shown as they
+// are, HDR ones tone mapped with params' settings.
+//
+// \return true if the display frame already shows the source (no edits yet)
+//
+bool loadSource(processingGraph* graph, previewPipeline* preview, frameBuffers* buffers, const planarImage& source, const renderParams& params);
+
+#endif
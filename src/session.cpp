@@ -0,0 +1,256 @@
+#include "session.h"
+#include "imagecache.h"
+#include "threadpool.h"
+#include "profile.h"
+#include "tonemap.h"
+#include "filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+typedef std::chrono::steady_clock sessionClock;
+
+//milliseconds from a to b
+static double elapsedMs(sessionClock::time_point a, sessionClock::time_point b){
+  return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+bool sessionRecorder::begin(std::string name){
+  this->file.open(name.c_str());
+  if(!this->file){
+    std::cout << "Can't write session " << name << std::endl;
+    return false;
+  }
+  this->file << "# time gamma gain bias op autoExposure radius type image toneSet filterSet\n";
+  //enough digits that every float reads back exactly
+  this->file << std::setprecision(9);
+  this->start = sessionClock::now();
+  return true;
+}
+
+void sessionRecorder::record(const renderParams& params){
+  if(!this->file.is_open()) return;
+  double time = std::chrono::duration<double>(sessionClock::now() - this->start).count();
+  this->file << time << " " << params.gamma << " " << params.gain << " " << params.bias << " " << params.op << " "
+             << (params.autoExposure ? 1 : 0) << " " << params.radius << " " << params.type << " " << params.image << " "
+             << (params.toneSet ? 1 : 0) << " " << (params.filterSet ? 1 : 0) << "\n";
+  //flushed every step so a crash still leaves the session that led up to it
+  this->file.flush();
+}
+
+bool sessionRecorder::active(){
+  return this->file.is_open();
+}
+
+bool readSession(std::string name, std::vector<sessionStep>& steps){
+  std::ifstream file(name.c_str());
+  if(!file){
+    std::cout << "Can't read session " << name << std::endl;
+    return false;
+  }
+  steps.clear();
+  std::string line;
+  int number = 0;
+  while(std::getline(file, line)){
+    number++;
+    size_t first = line.find_first_not_of(" \t\r");
+    if(first == std::string::npos || line[first] == '#') continue;
+    std::istringstream fields(line);
+    sessionStep step;
+    int autoExposure, toneSet, filterSet;
+    renderParams& p = step.params;
+    if(!(fields >> step.time >> p.gamma >> p.gain >> p.bias >> p.op >> autoExposure >> p.radius >> p.type >> p.image >> toneSet >> filterSet)){
+      std::cout << name << ":" << number << ": expected 11 fields" << std::endl;
+      return false;
+    }
+    //type is -1 until the viewer's n or m is first pressed
+    if(p.op < TONE_POWER || p.op > TONE_LOCAL || p.radius < 1 || p.type < -1 || p.type > KERNEL_BILATERAL || p.image < 0){
+      std::cout << name << ":" << number << ": value out of range" << std::endl;
+      return false;
+    }
+    p.autoExposure = autoExposure != 0;
+    p.toneSet = toneSet != 0;
+    p.filterSet = filterSet != 0;
+    p.serial = 0;
+    steps.push_back(step);
+  }
+  return true;
+}
+
+sessionPlayer::sessionPlayer(){
+  this->realtime = false;
+  this->nextStep = 0;
+  this->timeouts = 0;
+}
+
+bool sessionPlayer::load(std::string name, bool realtime){
+  this->realtime = realtime;
+  this->nextStep = 0;
+  return readSession(name, this->steps);
+}
+
+void sessionPlayer::begin(){
+  this->start = sessionClock::now();
+  std::cout << "step,time,latency_ms\n";
+}
+
+void sessionPlayer::expire(){
+  sessionClock::time_point now = sessionClock::now();
+  while(!this->pending.empty() && elapsedMs(this->pending.front().posted, now) >= REPLAY_TIMEOUT_MS){
+    std::cout << this->pending.front().step << "," << this->steps[this->pending.front().step].time << ",none\n";
+    this->timeouts++;
+    this->pending.pop_front();
+  }
+}
+
+bool sessionPlayer::active(){
+  expire();
+  return this->nextStep < this->steps.size() || !this->pending.empty();
+}
+
+bool sessionPlayer::due(){
+  expire();
+  if(this->nextStep >= this->steps.size()) return false;
+  if(!this->realtime) return this->pending.empty();
+  return elapsedMs(this->start, sessionClock::now()) >= this->steps[this->nextStep].time * 1000.0;
+}
+
+int sessionPlayer::returnWait(){
+  sessionClock::time_point now = sessionClock::now();
+  double wait = REPLAY_TIMEOUT_MS;
+  if(!this->pending.empty()) wait = REPLAY_TIMEOUT_MS - elapsedMs(this->pending.front().posted, now);
+  if(this->realtime && this->nextStep < this->steps.size()){
+    wait = std::min(wait, this->steps[this->nextStep].time * 1000.0 - elapsedMs(this->start, now));
+  } else if(this->pending.empty() && this->nextStep < this->steps.size()){
+    wait = 0.0;
+  }
+  //rounded up so a caller that sleeps this long finds the step due
+  return std::max(0, (int)wait + 1);
+}
+
+const renderParams& sessionPlayer::next(){
+  return this->steps[this->nextStep++].params;
+}
+
+void sessionPlayer::posted(unsigned serial){
+  pendingStep step;
+  step.step = this->nextStep - 1;
+  step.serial = serial;
+  step.posted = sessionClock::now();
+  this->pending.push_back(step);
+}
+
+void sessionPlayer::shown(unsigned serial){
+  sessionClock::time_point now = sessionClock::now();
+  //a frame made with newer parameters also finishes the steps they replaced
+  while(!this->pending.empty() && this->pending.front().serial <= serial){
+    const pendingStep& done = this->pending.front();
+    double latency = elapsedMs(done.posted, now);
+    this->latencies.push_back(latency);
+    std::cout << done.step << "," << this->steps[done.step].time << "," << latency << "\n";
+    this->pending.pop_front();
+  }
+}
+
+void sessionPlayer::printSummary(){
+  std::vector<double> sorted(this->latencies);
+  std::sort(sorted.begin(), sorted.end());
+  std::cout << this->steps.size() << " steps";
+  if(!sorted.empty()){
+    double sum = 0.0;
+    for(size_t i = 0; i < sorted.size(); i++){
+      sum = sum + sorted[i];
+    }
+    std::cout << ", latency mean " << sum / sorted.size() << "ms, median " << sorted[sorted.size() / 2]
+              << "ms, p99 " << sorted[(size_t)ceil(0.99 * sorted.size()) - 1]
+              << "ms, max " << sorted.back() << "ms";
+  }
+  std::cout << ", " << this->timeouts << " without a frame" << std::endl;
+}
+
+int runReplay(int argc, char** argv){
+  if(argc < 2){
+    std::cout << "usage: prog02 -replay session.txt [-realtime] [-fused] [-t threads] [-profile summary.json] [-trace trace.json] inputs..." << std::endl;
+    return 1;
+  }
+  std::string sessionName = argv[0];
+  bool realtime = false, fused = false;
+  std::string profileName, traceName;
+  std::vector<std::string> inputs;
+  for(int i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-realtime") == 0) realtime = true;
+    else if(strcmp(argv[i], "-fused") == 0) fused = true;
+    else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc) setPoolThreads(atoi(argv[++i]));
+    else if(strcmp(argv[i], "-profile") == 0 && i + 1 < argc) profileName = argv[++i];
+    else if(strcmp(argv[i], "-trace") == 0 && i + 1 < argc) traceName = argv[++i];
+    else if(argv[i][0] == '-'){
+      std::cout << "Unknown option " << argv[i] << " (or it is missing its value)" << std::endl;
+      return 1;
+    }
+    else inputs.push_back(argv[i]);
+  }
+  if(inputs.empty()){
+    std::cout << "No input images" << std::endl;
+    return 1;
+  }
+  if(!inputsReadable(inputs)) return 1;
+  sessionPlayer player;
+  if(!player.load(sessionName, realtime)) return 1;
+  setProfiling(!profileName.empty() || !traceName.empty(), !traceName.empty());
+
+  //the viewer's state before any key is pressed
+  renderParams params;
+  params.gamma = params.gain = params.bias = 1.0f;
+  params.op = TONE_POWER;
+  params.autoExposure = false;
+  params.radius = 1;
+  params.type = -1;
+  params.image = 0;
+  params.toneSet = false;
+  params.filterSet = false;
+  params.serial = 0;
+  imageCache cache(inputs, (size_t)IMAGE_CACHE_BUDGET_MB << 20);
+  frameBuffers buffers;
+  processingGraph graph(&buffers);
+  graph.setFused(fused);
+  std::shared_ptr<const planarImage> source = cache.acquire(params.image);
+  if(!source) return 1;
+  loadSource(&graph, NULL, &buffers, *source, params);
+  int shown = params.image;
+  unsigned serial = 0;
+
+  //every step runs to completion on this thread, so its latency is the time the pipeline took
+  player.begin();
+  while(player.active()){
+    if(!player.due()){
+      std::this_thread::sleep_for(std::chrono::milliseconds(player.returnWait()));
+      continue;
+    }
+    params = player.next();
+    if(params.image >= cache.returnCount()){
+      std::cout << "The session shows input " << params.image << " but only " << cache.returnCount() << " were given" << std::endl;
+      return 1;
+    }
+    params.serial = ++serial;
+    player.posted(serial);
+    if(params.image != shown){
+      shown = params.image;
+      source = cache.acquire(shown);
+      if(!source) return 1;
+      loadSource(&graph, NULL, &buffers, *source, params);
+    }
+    applyParams(&graph, params);
+    if(params.toneSet || params.filterSet) graph.evaluate();
+    player.shown(serial);
+  }
+  player.printSummary();
+  if(!profileName.empty()) writeProfile(profileName);
+  if(!traceName.empty()) writeTrace(traceName);
+  return 0;
+}
@@ -0,0 +1,112 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "render.h"
+
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+//in fast replay, a step that produces no frame (nothing changed) is given up on after this long
+#define REPLAY_TIMEOUT_MS 2000
+
+//
+// Session files are text, one line per parameter change the viewer posted:
+//
+//   time gamma gain bias op autoExposure radius type image toneSet filterSet
+//
+// time is in seconds since recording started, the flags are 0 or 1, and
+// lines starting with # are comments. The final line is the state the
+// session ended in, so any session (or a single line written by hand) also
+// works as a preset.
+//
+
+//one recorded parameter change
+struct sessionStep {
+  double time;
+  renderParams params;
+};
+
+//appends every posted parameter set to a session file
+class sessionRecorder {
+  private:
+    std::ofstream file;
+    std::chrono::steady_clock::time_point start;
+  public:
+    //starts the clock; false if name can't be written
+    bool begin(std::string name);
+    void record(const renderParams& params);
+    bool active();
+};
+
+//
+// Reads a session file into steps.
+// \return false, after printing why, if it can't be read or a line is malformed
+//
+bool readSession(std::string name, std::vector<sessionStep>& steps);
+
+//
+// Plays a session back and measures each step's latency: the time from
+// posting its parameters to the first frame made with them (or with newer
+// ones, when the step was superseded before it was drawn). Steps are due at
+// their recorded times in real time, or otherwise each as soon as the
+// previous one has been drawn (or REPLAY_TIMEOUT_MS passed without a frame).
+// Every finished step is printed as a CSV line (step, time, latency in ms)
+// and printSummary() adds the mean, median, p99 and max.
+//
+class sessionPlayer {
+  private:
+    struct pendingStep {
+      size_t step;
+      unsigned serial;
+      std::chrono::steady_clock::time_point posted;
+    };
+    std::vector<sessionStep> steps;
+    bool realtime;
+    size_t nextStep;
+    std::deque<pendingStep> pending;
+    std::chrono::steady_clock::time_point start;
+    std::vector<double> latencies;
+    int timeouts;
+    //gives up on steps that have waited REPLAY_TIMEOUT_MS for a frame
+    void expire();
+  public:
+    sessionPlayer();
+    //loads a session; false if it can't be read
+    bool load(std::string name, bool realtime);
+    //starts the clock and prints the CSV header
+    void begin();
+    //true once loaded and until every step has been drawn or timed out
+    bool active();
+    //true if the next step should be posted now
+    bool due();
+    //milliseconds the caller can sleep before due() might change
+    int returnWait();
+    //the next step's parameters; call when due()
+    const renderParams& next();
+    //the step returned by next() was posted with serial
+    void posted(unsigned serial);
+    //a frame made with parameters serial was drawn
+    void shown(unsigned serial);
+    void printSummary();
+};
+
+//
+// Headless replay: runs a recorded session against the full resolution
+// pipeline (no window, no preview) and reports the latency of every step.
+//
+//   prog02 -replay session.txt [-realtime] [-fused] [-t threads]
+//          [-profile summary.json] [-trace trace.json] inputs...
+//
+// The inputs must be the ones the session was recorded with, in the same
+// order, since steps refer to them by index.
+//
+// \param argc number of arguments after -replay
+// \param argv arguments after -replay
+// \return integer indicating success (0) or failure (nonzero)
+//
+int runReplay(int argc, char** argv);
+
+#endif
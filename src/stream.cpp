@@ -0,0 +1,230 @@
+#include "stream.h"
+#include "ppm.h"
+#include "hdr.h"
+#include "filter.h"
+#include "tonemap.h"
+#include "threadpool.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <vector>
+
+//pixels per column tile when a row is split over the pool
+#define STREAM_TILE 256
+
+//
+// Reads scanlines from either input format into a row of a planar image, in
+// the same 0-255 units the viewer uses.
+//
+class scanlineSource {
+  private:
+    bool radiance;
+    hdr hdrFile;
+    ppm ppmFile;
+    std::vector<unsigned char> bytes;
+    std::vector<float> row;
+    int width;
+    int height;
+  public:
+    //false, after printing why, if name can't be opened or isn't an image
+    bool begin(std::string name){
+      this->radiance = isHDRFile(name);
+      if(this->radiance){
+        if(!this->hdrFile.beginRead(name)) return false;
+        this->width = this->hdrFile.returnWidth();
+        this->height = this->hdrFile.returnHeight();
+      } else {
+        if(!this->ppmFile.beginRead(name)) return false;
+        this->width = this->ppmFile.returnWidth();
+        this->height = this->ppmFile.returnHeight();
+        this->bytes.resize(3 * this->width);
+      }
+      this->row.resize(3 * this->width);
+      return true;
+    }
+    //false, after printing why, if the row can't be decoded (rows missing from a short ppm read as zeroes)
+    bool read(planarImage& image, int y){
+      if(this->radiance){
+        if(!this->hdrFile.readScanline(&this->row[0])) return false;
+        image.setRow(y, &this->row[0], 255.0f);
+      } else if(this->ppmFile.returnEightBit()){
+        this->ppmFile.readScanline(&this->bytes[0]);
+        for(int i = 0; i < 3 * this->width; i++){
+          this->row[i] = this->bytes[i];
+        }
+        image.setRow(y, &this->row[0], 1.0f);
+      } else {
+        //16 bit, ASCII and PFM rows come in as floats with 1.0 as white
+        this->ppmFile.readScanline(&this->row[0]);
+        image.setRow(y, &this->row[0], 255.0f);
+      }
+      return true;
+    }
+    void end(){
+      if(this->radiance) this->hdrFile.endRead();
+      else this->ppmFile.endRead();
+    }
+    int returnWidth(){
+      return this->width;
+    }
+    int returnHeight(){
+      return this->height;
+    }
+};
+
+//runs fn(x0, x1) over fixed width column tiles so results don't depend on the thread count
+static void forEachColumnTile(int width, const std::function<void(int, int)>& fn){
+  int tiles = (width + STREAM_TILE - 1) / STREAM_TILE;
+  sharedPool()->parallelFor(tiles, [&](int t){
+    fn(t * STREAM_TILE, std::min(width, (t + 1) * STREAM_TILE));
+  });
+}
+
+//horizontal box pass over pixels [x0, x1) of one channel of a row, as a running sum
+static void boxRow(const float* src, float* dst, int radius, const std::vector<int>& idx, int x0, int x1){
+  double inv = 1.0 / (2.0 * radius + 1.0);
+  double sum = 0.0;
+  for(int t = x0; t < x0 + 2 * radius + 1; t++){
+    sum = sum + src[idx[t]];
+  }
+  for(int x = x0; x < x1; x++){
+    dst[x] = (float)(sum * inv);
+    sum = sum + src[idx[x + 2 * radius + 1]] - src[idx[x]];
+  }
+}
+
+//copies the reflected span a tile's taps read, zero filled out to whole blocks, so the tap loops need no index lookups
+static void padSpan(const float* src, std::vector<float>& pad, const std::vector<int>& idx, int x0, int count){
+  for(int i = 0; i < count; i++){
+    pad[i] = src[idx[x0 + i]];
+  }
+  for(int i = count; i < (int)pad.size(); i++){
+    pad[i] = 0.0f;
+  }
+}
+
+//zeroes pixels [x0, x1) of a row, rounded out to whole blocks
+static void clearSpan(float* dst, int x0, int x1){
+  for(int x = x0; x < x0 + alignedSpan(x1 - x0); x++){
+    dst[x] = 0.0f;
+  }
+}
+
+//horizontal pass of a general separable kernel over pixels [x0, x1) of one channel of a row
+static void kernelRow(const float* src, float* dst, const std::vector<float>& kernel, const std::vector<int>& idx, int x0, int x1){
+  std::vector<float> pad(alignedSpan(x1 - x0) + kernel.size() - 1);
+  padSpan(src, pad, idx, x0, x1 - x0 + (int)kernel.size() - 1);
+  clearSpan(dst, x0, x1);
+  for(int t = 0; t < (int)kernel.size(); t++){
+    accumulateSpan(dst + x0, &pad[t], kernel[t], x1 - x0);
+  }
+}
+
+//vertical pass: weights the window's (already horizontally filtered) rows
+static void verticalRow(const std::vector<const float*>& rows, float* dst, const std::vector<float>& kernel, int x0, int x1){
+  clearSpan(dst, x0, x1);
+  for(int t = 0; t < (int)kernel.size(); t++){
+    accumulateSpan(dst + x0, rows[t] + x0, kernel[t], x1 - x0);
+  }
+}
+
+//full 2D kernel over the window's raw rows for the non-separable cases
+static void kernelRow2D(const std::vector<const float*>& rows, float* dst, int radius, const std::vector<float>& kernel, const std::vector<int>& idx, int x0, int x1){
+  int size = 2 * radius + 1;
+  std::vector<float> pad(alignedSpan(x1 - x0) + 2 * radius);
+  clearSpan(dst, x0, x1);
+  for(int i = 0; i < size; i++){
+    padSpan(rows[i], pad, idx, x0, x1 - x0 + 2 * radius);
+    for(int j = 0; j < size; j++){
+      accumulateSpan(dst + x0, &pad[j], kernel[i * size + j], x1 - x0);
+    }
+  }
+}
+
+int streamImage(std::string input, std::string output, float gamma, float gain, float bias, int radius, int type, int format, int op){
+  static profileStage* stage = profileStageFor("streamImage");
+  scopedTimer timer(stage);
+  scanlineSource source;
+  if(!source.begin(input)) return STREAM_UNREADABLE;
+  int width = source.returnWidth();
+  int height = source.returnHeight();
+  timer.setPixels((long long)width * height);
+  bool filtering = type != KERNEL_NONE && radius >= 1;
+  if(!filtering) radius = 0;
+  bool separable = filtering && isSeparable(type);
+
+  //every row an output row reads lies in [y - radius, y + radius] once reflected,
+  //so a ring of that many rows (or the whole image, if it is shorter) is enough
+  int window = std::min(2 * radius + 1, height);
+  planarImage rows, raw, filtered;
+  rows.resize(width, window);
+  raw.resize(width, 1);
+  filtered.resize(width, 1);
+  std::vector<unsigned char> pixels(3 * width);
+  std::vector<int> slots(2 * radius + 1);
+  std::vector<float> kernel;
+  std::vector<int> idx(width + 2 * radius + 1);
+  for(int i = 0; i < (int)idx.size(); i++){
+    idx[i] = reflectIndex(i - radius, width);
+  }
+  if(separable) buildKernel1D(radius, type, kernel);
+  else if(filtering) buildKernel2D(radius, type, kernel);
+  std::shared_ptr<const toneCurve> curve = toneCurveFor(op, gamma, gain, bias);
+
+  ppm result;
+  result.setFormat(format, 255);
+  result.beginWrite(output, width, height);
+  int loaded = 0;
+  for(int y = 0; y < height; y++){
+    //pull in rows until everything below y that the kernel touches has arrived
+    int last = std::min(height - 1, y + radius);
+    while(loaded <= last){
+      int slot = loaded % window;
+      //a bad row only shows up once it is read; the partial output is removed
+      if(!source.read(separable ? raw : rows, separable ? 0 : slot)){
+        result.endWrite();
+        source.end();
+        std::remove(output.c_str());
+        return STREAM_UNREADABLE;
+      }
+      if(separable){
+        forEachColumnTile(width, [&](int x0, int x1){
+          for(int c = 0; c < 3; c++){
+            if(type == KERNEL_BOX) boxRow(raw.returnRow(c, 0), rows.returnRow(c, slot), radius, idx, x0, x1);
+            else kernelRow(raw.returnRow(c, 0), rows.returnRow(c, slot), kernel, idx, x0, x1);
+          }
+        });
+      }
+      loaded++;
+    }
+    for(int t = 0; t < 2 * radius + 1; t++){
+      slots[t] = reflectIndex(y - radius + t, height) % window;
+    }
+    //convolve, tone map and pack each tile while it is still in cache
+    forEachColumnTile(width, [&](int x0, int x1){
+      const planarImage* toned = &rows;
+      int row = slots[0];
+      if(filtering){
+        std::vector<const float*> taps(2 * radius + 1);
+        for(int c = 0; c < 3; c++){
+          for(int t = 0; t < 2 * radius + 1; t++){
+            taps[t] = rows.returnRow(c, slots[t]);
+          }
+          if(separable) verticalRow(taps, filtered.returnRow(c, 0), kernel, x0, x1);
+          else kernelRow2D(taps, filtered.returnRow(c, 0), radius, kernel, idx, x0, x1);
+        }
+        toned = &filtered;
+        row = 0;
+      }
+      toneMapRowRGB24(*curve, toned->returnRow(0, row) + x0, toned->returnRow(1, row) + x0, toned->returnRow(2, row) + x0,
+                      &pixels[3 * x0], x1 - x0);
+    });
+    result.writeScanline(&pixels[0]);
+  }
+  bool written = result.endWrite();
+  source.end();
+  return written ? STREAM_WRITTEN : STREAM_UNWRITABLE;
+}
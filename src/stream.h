@@ -0,0 +1,40 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <string>
+
+//what streamImage() made of an image
+#define STREAM_WRITTEN 0
+//the input couldn't be opened or decoded; nothing is left at output
+#define STREAM_UNREADABLE 1
+//the output couldn't be opened or written
+#define STREAM_UNWRITABLE 2
+
+//
+// Filters and tone maps an image a scanline at a time, for images too large
+// to hold in memory. Rows are read from a ppm, PFM or Radiance .hdr file
+// into a rolling window of 2 * radius + 1 rows; as soon as every row an
+// output row depends on has arrived it is convolved, tone mapped and written
+// to output as an 8 bit ppm (binary or ASCII). Peak memory is
+// O(width * radius), whatever the height.
+//
+// Borders are reflected as in convolution(), but the passes accumulate in a
+// different order, so results can differ from the in-memory path in the
+// last bits of the floats.
+//
+// \param input ppm (P6 or P3), PFM or Radiance .hdr file
+// \param output ppm file to write
+// \param gamma value to correct by
+// \param gain multiplier applied to luminance before the curve
+// \param bias offset applied to luminance before the curve
+// \param radius kernel radius in pixels
+// \param type KERNEL_BOX, KERNEL_GAUSSIAN, KERNEL_NONE, or anything else for
+//        sharpen (not KERNEL_BILATERAL, which needs the whole image)
+// \param format PPM_BINARY or PPM_ASCII
+// \param op tone operator, any but TONE_LOCAL
+// \return STREAM_WRITTEN, or STREAM_UNREADABLE or STREAM_UNWRITABLE after
+//         printing why
+//
+int streamImage(std::string input, std::string output, float gamma, float gain, float bias, int radius, int type, int format, int op);
+
+#endif
@@ -0,0 +1,99 @@
+#include "threadpool.h"
+
+threadPool::threadPool(int threads){
+  this->stop = false;
+  //the calling thread counts as one of the workers
+  for(int i = 1; i < threads; i++){
+    this->workers.push_back(std::thread(&threadPool::workerLoop, this));
+  }
+}
+
+threadPool::~threadPool(){
+  {
+    std::unique_lock<std::mutex> guard(this->lock);
+    this->stop = true;
+  }
+  this->wake.notify_all();
+  for(size_t i = 0; i < this->workers.size(); i++){
+    this->workers[i].join();
+  }
+}
+
+void threadPool::runItems(job* j){
+  int i;
+  while((i = j->next++) < j->count){
+    j->task(i);
+    if(++j->done == j->count){
+      std::unique_lock<std::mutex> guard(this->lock);
+      this->finished.notify_all();
+    }
+  }
+}
+
+void threadPool::workerLoop(){
+  while(true){
+    std::shared_ptr<job> current;
+    {
+      std::unique_lock<std::mutex> guard(this->lock);
+      while(true){
+        //drop loops that have no items left to hand out
+        while(!this->jobs.empty() && this->jobs.front()->next >= this->jobs.front()->count){
+          this->jobs.pop_front();
+        }
+        if(this->stop || !this->jobs.empty()) break;
+        this->wake.wait(guard);
+      }
+      if(this->jobs.empty()) return;
+      current = this->jobs.front();
+    }
+    runItems(current.get());
+  }
+}
+
+void threadPool::parallelFor(int count, const std::function<void(int)>& task){
+  if(count <= 0) return;
+  if(this->workers.empty() || count == 1){
+    for(int i = 0; i < count; i++){
+      task(i);
+    }
+    return;
+  }
+  std::shared_ptr<job> j(new job());
+  j->task = task;
+  j->count = count;
+  j->next = 0;
+  j->done = 0;
+  {
+    std::unique_lock<std::mutex> guard(this->lock);
+    this->jobs.push_back(j);
+  }
+  this->wake.notify_all();
+  runItems(j.get());
+  std::unique_lock<std::mutex> guard(this->lock);
+  while(j->done < count){
+    this->finished.wait(guard);
+  }
+}
+
+int threadPool::returnThreads(){
+  return (int)this->workers.size() + 1;
+}
+
+static std::unique_ptr<threadPool> pool;
+static std::mutex poolLock;
+
+threadPool* sharedPool(){
+  std::unique_lock<std::mutex> guard(poolLock);
+  if(!pool){
+    int threads = (int)std::thread::hardware_concurrency();
+    pool.reset(new threadPool(threads > 0 ? threads : 1));
+  }
+  return pool.get();
+}
+
+void setPoolThreads(int threads){
+  if(threads <= 0) threads = (int)std::thread::hardware_concurrency();
+  if(threads <= 0) threads = 1;
+  std::unique_lock<std::mutex> guard(poolLock);
+  pool.reset(new threadPool(threads));
+}
@@ -0,0 +1,49 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Fixed set of worker threads that split loops between them. The thread that
+// calls parallelFor always helps run its own loop, so several threads may use
+// the same pool at once (and loops may nest) without deadlocking.
+//
+class threadPool {
+  private:
+    struct job {
+      std::function<void(int)> task;
+      int count;
+      std::atomic<int> next;
+      std::atomic<int> done;
+    };
+    std::vector<std::thread> workers;
+    std::deque<std::shared_ptr<job> > jobs;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    bool stop;
+    void workerLoop();
+    void runItems(job* j);
+  public:
+    threadPool(int threads);
+    ~threadPool();
+    //calls task(i) for every i in [0, count) and returns once all have finished
+    void parallelFor(int count, const std::function<void(int)>& task);
+    //number of threads that run work, including the caller
+    int returnThreads();
+};
+
+//pool shared by the image kernels; created on first use
+threadPool* sharedPool();
+
+//sets the number of threads the shared pool uses (0 picks one per core)
+void setPoolThreads(int threads);
+
+#endif
@@ -0,0 +1,609 @@
+#include "tonemap.h"
+#include "filter.h"
+#include "threadpool.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//the SIMD paths are compiled per function and picked at runtime through CPUID
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TONEMAP_X86 1
+#include <immintrin.h>
+#endif
+
+//pixels handed to a worker at a time
+#define TONE_CHUNK 65536
+
+//largest luminance sum 20r + 40g + b an 8 bit pixel can have
+#define TONE_SUM_MAX (61 * 255)
+//the float table splits every octave of luminance into 2^TONE_LUT_BITS segments
+#define TONE_LUT_BITS 7
+#define TONE_LUT_SHIFT (23 - TONE_LUT_BITS)
+//octaves the float table covers, starting at 2^TONE_LUT_MIN_EXP
+#define TONE_LUT_MIN_EXP -16
+#define TONE_LUT_OCTAVES 40
+//segments further than this (relative) from the curve at their midpoint are computed exactly instead
+#define TONE_LUT_TOLERANCE 2e-5
+//tables kept for recently used settings (the preview and the full frame get different ones under auto exposure)
+#define TONE_CURVE_CACHE 4
+//added to luminance (1.0 = white) before taking its log, so black pixels don't dominate the averages
+#define TONE_LOG_DELTA 1e-4f
+
+//rows handed to a worker at a time for an image width pixels wide
+static int chunkRows(int width){
+  return std::max(1, TONE_CHUNK / std::max(1, width));
+}
+
+//Hable's filmic curve (from Uncharted 2)
+static inline float filmic(float x){
+  const float A = 0.15f, B = 0.50f, C = 0.10f, D = 0.20f, E = 0.02f, F = 0.30f;
+  return (x * (A * x + C * B) + D * E) / (x * (A * x + B) + D * F) - E / F;
+}
+
+//the 0-1 result of a global operator other than TONE_POWER for exposed luminance l
+static inline float mapLuminance(int op, float l, float white){
+  if(op == TONE_FILMIC) return filmic(l) / filmic(white > 0.0f ? white : 1.0f);
+  //Reinhard; without a white point nothing quite reaches 1
+  float burn = white > 0.0f ? l / (white * white) : 0.0f;
+  return l * (1.0f + burn) / (1.0f + l);
+}
+
+//
+// What a pixel's channels get multiplied by: the curve applied to its
+// luminance, divided by that luminance. Zero where the curve is undefined.
+// TONE_LOCAL gets the global Reinhard curve here (see localRow).
+//
+static inline float curveScale(float lum, int op, float gamma, float gain, float bias){
+  if(op == TONE_POWER){
+    float x = gain * lum + bias;
+    return (lum > 0.0f && x > 0.0f) ? powf(x, gamma) / lum : 0.0f;
+  }
+  if(!(lum > 0.0f)) return 0.0f;
+  float mapped = mapLuminance(op, gain * lum * (1.0f / 255.0f), bias);
+  return mapped > 0.0f ? 255.0f * powf(mapped, gamma) / lum : 0.0f;
+}
+
+//
+// The scale factor for one gamma/gain/bias, tabulated two ways. exact holds
+// it for every luminance sum an 8 bit pixel can produce, so 8 bit sources get
+// the same results as calling curveScale. segments covers float luminance:
+// the top bits of the float (exponent and TONE_LUT_BITS of mantissa) pick a
+// segment and the scale is interpolated linearly across it from a (start,
+// slope) pair. Segments that cannot meet TONE_LUT_TOLERANCE (next to where
+// the curve stops being defined, or too steep) hold NaN, as do the two
+// sentinels that out of range luminance (zero, negative, huge, NaN) clamps
+// to; pixels that land on NaN are computed with curveScale.
+//
+struct toneCurve {
+  int op;
+  float gamma;
+  float gain;
+  float bias;
+  std::vector<float> exact;
+  std::vector<float> segments;
+  //subtracted from (float bits >> TONE_LUT_SHIFT) to give a segment index
+  int base;
+  //index of the upper sentinel
+  int last;
+};
+
+static void buildCurve(toneCurve& curve, int op, float gamma, float gain, float bias){
+  curve.op = op;
+  curve.gamma = gamma;
+  curve.gain = gain;
+  curve.bias = bias;
+  curve.exact.resize(TONE_SUM_MAX + 1);
+  for(int s = 0; s <= TONE_SUM_MAX; s++){
+    //same arithmetic as the per pixel path, so the table is exact
+    curve.exact[s] = curveScale((float)s * (1.0f / 61.0f), op, gamma, gain, bias);
+  }
+  int count = TONE_LUT_OCTAVES << TONE_LUT_BITS;
+  //index 0 is the lower sentinel, so segment i starts at bits (base + i) << TONE_LUT_SHIFT
+  curve.base = ((127 + TONE_LUT_MIN_EXP) << TONE_LUT_BITS) - 1;
+  curve.last = count + 1;
+  curve.segments.assign(2 * (count + 2), NAN);
+  for(int i = 1; i <= count; i++){
+    int lowBits = (curve.base + i) << TONE_LUT_SHIFT, highBits = (curve.base + i + 1) << TONE_LUT_SHIFT;
+    float low, high;
+    memcpy(&low, &lowBits, sizeof(float));
+    memcpy(&high, &highBits, sizeof(float));
+    float a = curveScale(low, op, gamma, gain, bias), b = curveScale(high, op, gamma, gain, bias);
+    //the other operators are defined for any positive luminance
+    float x0 = op == TONE_POWER ? gain * low + bias : 1.0f, x1 = op == TONE_POWER ? gain * high + bias : 1.0f;
+    if(x0 <= 0.0f && x1 <= 0.0f){
+      //the curve is undefined over the whole segment (the line through x is monotonic)
+      curve.segments[2 * i] = 0.0f;
+      curve.segments[2 * i + 1] = 0.0f;
+      continue;
+    }
+    if(x0 <= 0.0f || x1 <= 0.0f || !std::isfinite(a) || !std::isfinite(b)) continue;
+    double middle = curveScale(0.5f * (low + high), op, gamma, gain, bias);
+    if(fabs(0.5 * ((double)a + b) - middle) > TONE_LUT_TOLERANCE * fabs(middle)) continue;
+    curve.segments[2 * i] = a;
+    curve.segments[2 * i + 1] = b - a;
+  }
+}
+
+//tables for the last few tone settings used, most recent first
+static std::mutex curveLock;
+static std::shared_ptr<const toneCurve> cachedCurves[TONE_CURVE_CACHE];
+
+std::shared_ptr<const toneCurve> toneCurveFor(int op, float gamma, float gain, float bias){
+  std::unique_lock<std::mutex> guard(curveLock);
+  int found = TONE_CURVE_CACHE - 1;
+  for(int i = 0; i < TONE_CURVE_CACHE; i++){
+    const std::shared_ptr<const toneCurve>& curve = cachedCurves[i];
+    if(curve && curve->op == op && curve->gamma == gamma && curve->gain == gain && curve->bias == bias){
+      found = i;
+      break;
+    }
+  }
+  std::shared_ptr<const toneCurve> curve = cachedCurves[found];
+  if(!curve || curve->op != op || curve->gamma != gamma || curve->gain != gain || curve->bias != bias){
+    //not cached: the least recently used slot gets the new table
+    std::shared_ptr<toneCurve> built(new toneCurve());
+    buildCurve(*built, op, gamma, gain, bias);
+    curve = built;
+  }
+  for(int i = found; i > 0; i--){
+    cachedCurves[i] = cachedCurves[i - 1];
+  }
+  cachedCurves[0] = curve;
+  return curve;
+}
+
+//scale for 8 bit channel values, whose luminance sum is an exact integer
+static inline float exactScale(const toneCurve& curve, float r, float g, float b){
+  int s = (int)(20.0f * r + 40.0f * g + b);
+  return curve.exact[std::min(std::max(s, 0), TONE_SUM_MAX)];
+}
+
+//scale for any float luminance, interpolated from the segment table
+static inline float tableScale(const toneCurve& curve, float lum){
+  int bits;
+  memcpy(&bits, &lum, sizeof(float));
+  int i = std::min(std::max((bits >> TONE_LUT_SHIFT) - curve.base, 0), curve.last);
+  float frac = (float)(bits & ((1 << TONE_LUT_SHIFT) - 1)) * (1.0f / (1 << TONE_LUT_SHIFT));
+  float scale = curve.segments[2 * i] + frac * curve.segments[2 * i + 1];
+  if(scale != scale) scale = curveScale(lum, curve.op, curve.gamma, curve.gain, curve.bias);
+  return scale;
+}
+
+//luminance of a pixel with 1.0 as white
+static inline float whiteLuminance(float r, float g, float b){
+  return (20.0f * r + 40.0f * g + b) * (1.0f / (61.0f * 255.0f));
+}
+
+//
+// What TONE_LOCAL adapts each pixel to: the mean luminance (1.0 = white) of
+// factor x factor blocks of the image, blurred in the log domain, in channel
+// 0 of blurred. Pixel x lies between the block columns xLow[x] and xHigh[x],
+// xWeight[x] of the way to the second.
+//
+struct localAdaptation {
+  planarImage blurred;
+  int factor;
+  std::vector<int> xLow;
+  std::vector<int> xHigh;
+  std::vector<float> xWeight;
+};
+
+static void buildAdaptation(const planarImage& in, localAdaptation& local){
+  static profileStage* stage = profileStageFor("toneMap::adaptation");
+  int width = in.returnWidth(), height = in.returnHeight();
+  scopedTimer timer(stage, (long long)width * height);
+  int f = std::max(1, std::min(width, height) / TONE_LOCAL_SIDE);
+  int smallWidth = (width + f - 1) / f, smallHeight = (height + f - 1) / f;
+  local.factor = f;
+  planarImage blocks;
+  blocks.resize(smallWidth, smallHeight);
+  sharedPool()->parallelFor(smallHeight, [&](int sy){
+    int y0 = sy * f, y1 = std::min(height, y0 + f);
+    float* out = blocks.returnRow(0, sy);
+    for(int sx = 0; sx < smallWidth; sx++){
+      int x0 = sx * f, x1 = std::min(width, x0 + f);
+      double sum = 0.0;
+      for(int y = y0; y < y1; y++){
+        const float* r = in.returnRow(0, y);
+        const float* g = in.returnRow(1, y);
+        const float* b = in.returnRow(2, y);
+        for(int x = x0; x < x1; x++){
+          sum = sum + whiteLuminance(r[x], g[x], b[x]);
+        }
+      }
+      float mean = (float)(sum / ((double)(y1 - y0) * (x1 - x0)));
+      if(!(mean > 0.0f)) mean = 0.0f;
+      out[sx] = log2f(mean + TONE_LOG_DELTA);
+    }
+  });
+  //only channel 0 holds anything, so only it is blurred
+  convolvePlane(blocks, local.blurred, TONE_LOCAL_RADIUS, KERNEL_GAUSSIAN);
+  //back out of the log domain once here rather than once per pixel
+  for(int sy = 0; sy < smallHeight; sy++){
+    float* row = local.blurred.returnRow(0, sy);
+    for(int sx = 0; sx < smallWidth; sx++){
+      row[sx] = exp2f(row[sx]);
+    }
+  }
+  local.xLow.resize(width);
+  local.xHigh.resize(width);
+  local.xWeight.resize(width);
+  for(int x = 0; x < width; x++){
+    //block centres sit at (i + 0.5) * f
+    float sx = std::min(std::max(((float)x + 0.5f) / f - 0.5f, 0.0f), (float)(smallWidth - 1));
+    local.xLow[x] = (int)sx;
+    local.xHigh[x] = std::min(local.xLow[x] + 1, smallWidth - 1);
+    local.xWeight[x] = sx - (float)local.xLow[x];
+  }
+}
+
+//TONE_LOCAL's scales for row y: Reinhard, dividing by 1 + the interpolated local average instead of 1 + l
+static void localRow(const localAdaptation& local, const float* red, const float* green, const float* blue, float* scale, int y, int width, float gamma, float gain, float bias){
+  int smallHeight = local.blurred.returnHeight();
+  float sy = std::min(std::max(((float)y + 0.5f) / local.factor - 0.5f, 0.0f), (float)(smallHeight - 1));
+  int y0 = (int)sy, y1 = std::min(y0 + 1, smallHeight - 1);
+  float wy = sy - (float)y0;
+  const float* top = local.blurred.returnRow(0, y0);
+  const float* bottom = local.blurred.returnRow(0, y1);
+  float burn = bias > 0.0f ? 1.0f / (bias * bias) : 0.0f;
+  for(int x = 0; x < width; x++){
+    float lum = whiteLuminance(red[x], green[x], blue[x]);
+    if(!(lum > 0.0f)){
+      scale[x] = 0.0f;
+      continue;
+    }
+    int a = local.xLow[x], b = local.xHigh[x];
+    float wx = local.xWeight[x];
+    float upper = top[a] + wx * (top[b] - top[a]);
+    float lower = bottom[a] + wx * (bottom[b] - bottom[a]);
+    float average = gain * (upper + wy * (lower - upper));
+    float l = gain * lum;
+    float mapped = l * (1.0f + l * burn) / (1.0f + average);
+    if(gamma == 1.0f) scale[x] = mapped / lum;
+    else scale[x] = mapped > 0.0f ? powf(mapped, gamma) / lum : 0.0f;
+  }
+}
+
+void toneMap(const planarImage& in, planarImage& out, float gamma, float gain, float bias, int op){
+  int width = in.returnWidth(), height = in.returnHeight();
+  static profileStage* stage = profileStageFor("toneMap");
+  scopedTimer timer(stage, (long long)width * height);
+  int rows = chunkRows(width);
+  int chunks = (height + rows - 1) / rows;
+  if(op == TONE_LOCAL){
+    localAdaptation local;
+    buildAdaptation(in, local);
+    //out may be in, so each row's scales are worked out before it is overwritten
+    out.resize(width, height);
+    sharedPool()->parallelFor(chunks, [&](int chunk){
+      std::vector<float> scale(width);
+      int end = std::min(height, (chunk + 1) * rows);
+      for(int y = chunk * rows; y < end; y++){
+        localRow(local, in.returnRow(0, y), in.returnRow(1, y), in.returnRow(2, y), &scale[0], y, width, gamma, gain, bias);
+        for(int c = 0; c < 3; c++){
+          const float* src = in.returnRow(c, y);
+          float* dst = out.returnRow(c, y);
+          for(int i = 0; i < width; i++){
+            dst[i] = std::min(std::max(src[i] * scale[i], 0.0f), 255.0f);
+          }
+        }
+      }
+    });
+    return;
+  }
+  bool eightBit = in.returnEightBit();
+  std::shared_ptr<const toneCurve> curve = toneCurveFor(op, gamma, gain, bias);
+  out.resize(width, height);
+  //the loop itself, split into bands of rows across the shared pool
+  sharedPool()->parallelFor(chunks, [&](int chunk){
+    //vars used for calcuation
+    float lum, scale;
+    float r, g, b;
+    int end = std::min(height, (chunk + 1) * rows);
+    for(int y = chunk * rows; y < end; y++){
+      const float* inR = in.returnRow(0, y);
+      const float* inG = in.returnRow(1, y);
+      const float* inB = in.returnRow(2, y);
+      float* outR = out.returnRow(0, y);
+      float* outG = out.returnRow(1, y);
+      float* outB = out.returnRow(2, y);
+      for(int i = 0; i < width; i++){
+        //loading in values
+        r = inR[i];
+        g = inG[i];
+        b = inB[i];
+
+        //calculating L, then the scale to correct by from the table
+        lum = (20.0f * r + 40.0f * g + b) * (1.0f / 61.0f);
+        scale = eightBit ? exactScale(*curve, r, g, b) : tableScale(*curve, lum);
+
+        //correcting original values and clamping
+        r = r * scale;
+        if(r > 255) r = 255;
+        else if (r < 0.0) r = 0.0;
+        g = g * scale;
+        if(g > 255) g = 255;
+        else if (g < 0.0) g = 0.0;
+        b = b * scale;
+        if(b > 255) b = 255;
+        else if (b < 0.0) b = 0.0;
+
+        //saving corrected values; left unrounded so deep outputs keep the precision
+        outR[i] = r;
+        outG[i] = g;
+        outB[i] = b;
+      }
+    }
+  });
+}
+
+//clamps to [0, 255] (NaN goes to 0) and rounds half up
+static inline unsigned char quantize(float v){
+  if(!(v > 0.0f)) return 0;
+  if(v > 255.0f) return 255;
+  return (unsigned char)(int)(v + 0.5f);
+}
+
+//portable path; also finishes the pixels left over by the SIMD loops
+static void toneRangeScalar(const toneCurve& curve, bool eightBit, const float* red, const float* green, const float* blue, unsigned char* out, int start, int end){
+  for(int i = start; i < end; i++){
+    float r = red[i];
+    float g = green[i];
+    float b = blue[i];
+    float scale;
+    if(eightBit) scale = exactScale(curve, r, g, b);
+    else scale = tableScale(curve, (20.0f * r + 40.0f * g + b) * (1.0f / 61.0f));
+    out[3 * i] = quantize(r * scale);
+    out[3 * i + 1] = quantize(g * scale);
+    out[3 * i + 2] = quantize(b * scale);
+  }
+}
+
+#ifdef TONEMAP_X86
+
+//replaces the NaN lanes of scale (segments without a usable entry) with the exact value
+static void fixLanes(const toneCurve& curve, float* scale, const float* lum, int lanes){
+  for(int k = 0; k < lanes; k++){
+    if(scale[k] != scale[k]) scale[k] = curveScale(lum[k], curve.op, curve.gamma, curve.gain, curve.bias);
+  }
+}
+
+//four pixels per step; stops early enough that the 16 byte stores stay inside [start, end)
+__attribute__((target("sse4.1")))
+static void toneRangeSSE4(const toneCurve& curve, bool eightBit, const float* red, const float* green, const float* blue, unsigned char* out, int start, int end){
+  const __m128 zero = _mm_setzero_ps(), top = _mm_set1_ps(255.0f), half = _mm_set1_ps(0.5f);
+  const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  const __m128i base = _mm_set1_epi32(curve.base), last = _mm_set1_epi32(curve.last), sumMax = _mm_set1_epi32(TONE_SUM_MAX);
+  const __m128i mask = _mm_set1_epi32((1 << TONE_LUT_SHIFT) - 1);
+  const __m128 step = _mm_set1_ps(1.0f / (1 << TONE_LUT_SHIFT));
+  const float* exact = &curve.exact[0];
+  const float* segments = &curve.segments[0];
+  alignas(16) int index[4];
+  alignas(16) float lanes[4], scales[4];
+  int i = start;
+  for(; i + 6 <= end; i = i + 4){
+    __m128 r = _mm_loadu_ps(red + i), g = _mm_loadu_ps(green + i), bl = _mm_loadu_ps(blue + i);
+    __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(20.0f)), _mm_mul_ps(g, _mm_set1_ps(40.0f))), bl);
+    __m128 scale;
+    if(eightBit){
+      __m128i s = _mm_min_epi32(_mm_max_epi32(_mm_cvttps_epi32(sum), _mm_setzero_si128()), sumMax);
+      _mm_store_si128((__m128i*)index, s);
+      scale = _mm_setr_ps(exact[index[0]], exact[index[1]], exact[index[2]], exact[index[3]]);
+    } else {
+      __m128 lum = _mm_mul_ps(sum, _mm_set1_ps(1.0f / 61.0f));
+      __m128i bits = _mm_castps_si128(lum);
+      __m128i s = _mm_min_epi32(_mm_max_epi32(_mm_sub_epi32(_mm_srai_epi32(bits, TONE_LUT_SHIFT), base), _mm_setzero_si128()), last);
+      _mm_store_si128((__m128i*)index, s);
+      __m128 a = _mm_setr_ps(segments[2 * index[0]], segments[2 * index[1]], segments[2 * index[2]], segments[2 * index[3]]);
+      __m128 d = _mm_setr_ps(segments[2 * index[0] + 1], segments[2 * index[1] + 1], segments[2 * index[2] + 1], segments[2 * index[3] + 1]);
+      __m128 frac = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(bits, mask)), step);
+      scale = _mm_add_ps(a, _mm_mul_ps(frac, d));
+      if(_mm_movemask_ps(_mm_cmpunord_ps(scale, scale))){
+        _mm_store_ps(lanes, lum);
+        _mm_store_ps(scales, scale);
+        fixLanes(curve, scales, lanes, 4);
+        scale = _mm_load_ps(scales);
+      }
+    }
+    //min keeps NaN, max then turns it into 0
+    __m128i ri = _mm_cvttps_epi32(_mm_add_ps(_mm_max_ps(_mm_min_ps(top, _mm_mul_ps(r, scale)), zero), half));
+    __m128i gi = _mm_cvttps_epi32(_mm_add_ps(_mm_max_ps(_mm_min_ps(top, _mm_mul_ps(g, scale)), zero), half));
+    __m128i bi = _mm_cvttps_epi32(_mm_add_ps(_mm_max_ps(_mm_min_ps(top, _mm_mul_ps(bl, scale)), zero), half));
+    __m128i px = _mm_or_si128(ri, _mm_or_si128(_mm_slli_epi32(gi, 8), _mm_slli_epi32(bi, 16)));
+    _mm_storeu_si128((__m128i*)(out + 3 * i), _mm_shuffle_epi8(px, pack));
+  }
+  toneRangeScalar(curve, eightBit, red, green, blue, out, i, end);
+}
+
+//eight pixels per step, table entries fetched with gathers; the two overlapping 16 byte stores stay inside [start, end)
+__attribute__((target("avx2,fma")))
+static void toneRangeAVX2(const toneCurve& curve, bool eightBit, const float* red, const float* green, const float* blue, unsigned char* out, int start, int end){
+  const __m256 zero = _mm256_setzero_ps(), top = _mm256_set1_ps(255.0f), half = _mm256_set1_ps(0.5f);
+  const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  const __m256i base = _mm256_set1_epi32(curve.base), last = _mm256_set1_epi32(curve.last), sumMax = _mm256_set1_epi32(TONE_SUM_MAX);
+  const __m256i mask = _mm256_set1_epi32((1 << TONE_LUT_SHIFT) - 1);
+  const __m256 step = _mm256_set1_ps(1.0f / (1 << TONE_LUT_SHIFT));
+  const float* exact = &curve.exact[0];
+  const float* segments = &curve.segments[0];
+  alignas(32) float lanes[8], scales[8];
+  int i = start;
+  for(; i + 10 <= end; i = i + 8){
+    __m256 r = _mm256_loadu_ps(red + i), g = _mm256_loadu_ps(green + i), bl = _mm256_loadu_ps(blue + i);
+    __m256 sum = _mm256_fmadd_ps(r, _mm256_set1_ps(20.0f), _mm256_fmadd_ps(g, _mm256_set1_ps(40.0f), bl));
+    __m256 scale;
+    if(eightBit){
+      __m256i s = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(sum), _mm256_setzero_si256()), sumMax);
+      scale = _mm256_i32gather_ps(exact, s, 4);
+    } else {
+      __m256 lum = _mm256_mul_ps(sum, _mm256_set1_ps(1.0f / 61.0f));
+      __m256i bits = _mm256_castps_si256(lum);
+      __m256i s = _mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(_mm256_srai_epi32(bits, TONE_LUT_SHIFT), base), _mm256_setzero_si256()), last);
+      s = _mm256_add_epi32(s, s);
+      __m256 a = _mm256_i32gather_ps(segments, s, 4);
+      __m256 d = _mm256_i32gather_ps(segments + 1, s, 4);
+      __m256 frac = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(bits, mask)), step);
+      scale = _mm256_fmadd_ps(frac, d, a);
+      if(_mm256_movemask_ps(_mm256_cmp_ps(scale, scale, _CMP_UNORD_Q))){
+        _mm256_store_ps(lanes, lum);
+        _mm256_store_ps(scales, scale);
+        fixLanes(curve, scales, lanes, 8);
+        scale = _mm256_load_ps(scales);
+      }
+    }
+    __m256i ri = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_max_ps(_mm256_min_ps(top, _mm256_mul_ps(r, scale)), zero), half));
+    __m256i gi = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_max_ps(_mm256_min_ps(top, _mm256_mul_ps(g, scale)), zero), half));
+    __m256i bi = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_max_ps(_mm256_min_ps(top, _mm256_mul_ps(bl, scale)), zero), half));
+    __m256i px = _mm256_or_si256(ri, _mm256_or_si256(_mm256_slli_epi32(gi, 8), _mm256_slli_epi32(bi, 16)));
+    px = _mm256_shuffle_epi8(px, pack);
+    _mm_storeu_si128((__m128i*)(out + 3 * i), _mm256_castsi256_si128(px));
+    _mm_storeu_si128((__m128i*)(out + 3 * i + 12), _mm256_extracti128_si256(px, 1));
+  }
+  toneRangeScalar(curve, eightBit, red, green, blue, out, i, end);
+}
+
+#endif
+
+static int detectPath(){
+#ifdef TONEMAP_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return TONEMAP_AVX2;
+  if(__builtin_cpu_supports("sse4.1")) return TONEMAP_SSE4;
+#endif
+  return TONEMAP_SCALAR;
+}
+
+static int pathLimit = TONEMAP_AVX2;
+
+int toneMapPath(){
+  static int detected = detectPath();
+  return std::min(detected, pathLimit);
+}
+
+void setToneMapPath(int path){
+  pathLimit = path;
+}
+
+typedef void (*toneRange)(const toneCurve&, bool, const float*, const float*, const float*, unsigned char*, int, int);
+
+static toneRange pickRange(){
+#ifdef TONEMAP_X86
+  if(toneMapPath() == TONEMAP_AVX2) return toneRangeAVX2;
+  if(toneMapPath() == TONEMAP_SSE4) return toneRangeSSE4;
+#endif
+  return toneRangeScalar;
+}
+
+void toneMapRowRGB24(const toneCurve& curve, const float* red, const float* green, const float* blue, unsigned char* out, int count){
+  pickRange()(curve, false, red, green, blue, out, 0, count);
+}
+
+void toneMapRGB24(const planarImage& in, unsigned char* out, float gamma, float gain, float bias, int op){
+  int width = in.returnWidth(), height = in.returnHeight();
+  static profileStage* stage = profileStageFor("toneMapRGB24");
+  scopedTimer timer(stage, (long long)width * height);
+  int rows = chunkRows(width);
+  int chunks = (height + rows - 1) / rows;
+  if(op == TONE_LOCAL){
+    localAdaptation local;
+    buildAdaptation(in, local);
+    sharedPool()->parallelFor(chunks, [&](int chunk){
+      std::vector<float> scale(width);
+      int end = std::min(height, (chunk + 1) * rows);
+      for(int y = chunk * rows; y < end; y++){
+        const float* r = in.returnRow(0, y);
+        const float* g = in.returnRow(1, y);
+        const float* b = in.returnRow(2, y);
+        unsigned char* pixel = out + 3 * (size_t)width * y;
+        localRow(local, r, g, b, &scale[0], y, width, gamma, gain, bias);
+        for(int i = 0; i < width; i++){
+          pixel[3 * i] = quantize(r[i] * scale[i]);
+          pixel[3 * i + 1] = quantize(g[i] * scale[i]);
+          pixel[3 * i + 2] = quantize(b[i] * scale[i]);
+        }
+      }
+    });
+    return;
+  }
+  bool eightBit = in.returnEightBit();
+  std::shared_ptr<const toneCurve> curve = toneCurveFor(op, gamma, gain, bias);
+  toneRange range = pickRange();
+  sharedPool()->parallelFor(chunks, [&](int chunk){
+    int end = std::min(height, (chunk + 1) * rows);
+    for(int y = chunk * rows; y < end; y++){
+      range(*curve, eightBit, in.returnRow(0, y), in.returnRow(1, y), in.returnRow(2, y), out + 3 * (size_t)width * y, 0, width);
+    }
+  });
+}
+
+void measureTone(const planarImage& in, toneStats& stats){
+  int width = in.returnWidth(), height = in.returnHeight();
+  static profileStage* stage = profileStageFor("measureTone");
+  scopedTimer timer(stage, (long long)width * height);
+  int rows = chunkRows(width);
+  int chunks = (height + rows - 1) / rows;
+  //every chunk gets its own sums, added up in chunk order afterwards so the thread count can't change them
+  std::vector<long long> bins((size_t)chunks * TONE_HIST_BINS, 0);
+  std::vector<double> logSums(chunks, 0.0);
+  sharedPool()->parallelFor(chunks, [&](int chunk){
+    long long* hist = &bins[(size_t)chunk * TONE_HIST_BINS];
+    double sum = 0.0;
+    int end = std::min(height, (chunk + 1) * rows);
+    for(int y = chunk * rows; y < end; y++){
+      const float* r = in.returnRow(0, y);
+      const float* g = in.returnRow(1, y);
+      const float* b = in.returnRow(2, y);
+      for(int x = 0; x < width; x++){
+        float lum = whiteLuminance(r[x], g[x], b[x]);
+        if(!(lum > 0.0f)) lum = 0.0f;
+        float logLum = log2f(lum + TONE_LOG_DELTA);
+        sum = sum + logLum;
+        int bin = (int)std::min(std::max((logLum - TONE_HIST_MIN) * (TONE_HIST_BINS / TONE_HIST_STOPS), 0.0f), (float)(TONE_HIST_BINS - 1));
+        hist[bin]++;
+      }
+    }
+    logSums[chunk] = sum;
+  });
+  stats.histogram.assign(TONE_HIST_BINS, 0);
+  double logSum = 0.0;
+  for(int chunk = 0; chunk < chunks; chunk++){
+    logSum = logSum + logSums[chunk];
+    for(int i = 0; i < TONE_HIST_BINS; i++){
+      stats.histogram[i] = stats.histogram[i] + bins[(size_t)chunk * TONE_HIST_BINS + i];
+    }
+  }
+  long long total = (long long)width * height;
+  if(total == 0){
+    stats.logAverage = 1.0f;
+    stats.white = 1.0f;
+    return;
+  }
+  stats.logAverage = exp2f((float)(logSum / (double)total));
+  //the top of the first bin that brings the count up to the percentile
+  long long wanted = (long long)ceil(TONE_WHITE_PERCENTILE * (double)total);
+  long long seen = 0;
+  int bin = 0;
+  for(; bin < TONE_HIST_BINS - 1; bin++){
+    seen = seen + stats.histogram[bin];
+    if(seen >= wanted) break;
+  }
+  stats.white = exp2f(TONE_HIST_MIN + (float)(bin + 1) * (TONE_HIST_STOPS / TONE_HIST_BINS));
+}
+
+void autoExposure(const toneStats& stats, int op, float gamma, float& gain, float& bias){
+  float white = stats.white > 0.0f ? stats.white : 1.0f;
+  if(op == TONE_POWER){
+    //pow(gain * 255 * white, gamma) = 255
+    float g = gamma > 0.0f ? gamma : 1.0f;
+    gain = powf(255.0f, 1.0f / g) / (255.0f * white);
+    bias = 0.0f;
+    return;
+  }
+  gain = stats.logAverage > 0.0f ? TONE_KEY / stats.logAverage : 1.0f;
+  bias = gain * white;
+}
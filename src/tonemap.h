@@ -0,0 +1,121 @@
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include "image.h"
+
+#include <memory>
+#include <vector>
+
+//instruction sets toneMapRGB24 can run on, slowest first
+#define TONEMAP_SCALAR 0
+#define TONEMAP_SSE4 1
+#define TONEMAP_AVX2 2
+
+//tone operators, picked by the op argument of the tone mappers
+//pow(gain * L + bias, gamma) on 0-255 luminance
+#define TONE_POWER 0
+//the rest work on l = gain * L / 255 (gain is the exposure) and raise their
+//0-1 result to gamma; bias is the white point
+//Reinhard's global operator, l * (1 + l / white^2) / (1 + l)
+#define TONE_REINHARD 1
+//Hable's filmic curve, with a toe and a shoulder, scaled so white maps to 1
+#define TONE_FILMIC 2
+//Reinhard with the 1 + l divisor replaced by 1 + the local average of l,
+//taken from a blurred, downsampled copy of the luminance (whole images only)
+#define TONE_LOCAL 3
+//the adaptation image for TONE_LOCAL is about this many pixels across the shorter side
+#define TONE_LOCAL_SIDE 64
+//gaussian radius it is blurred with, in its own pixels
+#define TONE_LOCAL_RADIUS 4
+
+//auto exposure puts the log average luminance at this middle grey...
+#define TONE_KEY 0.18f
+//...and keeps this fraction of the pixels below white
+#define TONE_WHITE_PERCENTILE 0.995f
+//the luminance histogram has TONE_HIST_BINS bins over TONE_HIST_STOPS stops, starting at 2^TONE_HIST_MIN
+#define TONE_HIST_BINS 256
+#define TONE_HIST_MIN -16.0f
+#define TONE_HIST_STOPS 32.0f
+
+//luminance statistics that auto exposure is worked out from; 1.0 is white (255)
+struct toneStats {
+  //exp2 of the mean log2 luminance
+  float logAverage;
+  //luminance TONE_WHITE_PERCENTILE of the pixels are below
+  float white;
+  //pixel counts per bin of log2 luminance
+  std::vector<long long> histogram;
+};
+
+//
+// Measures the log average luminance and the luminance histogram of an
+// image in one pass, spread over the shared pool. Results do not depend on
+// the number of threads.
+//
+// \param in planar RGB image
+// \param stats filled in with the results
+//
+void measureTone(const planarImage& in, toneStats& stats);
+
+//
+// Sets gain and bias for operator op from measured statistics, keeping gamma.
+// The curve operators get gain = TONE_KEY / log average and the white point
+// at the TONE_WHITE_PERCENTILE luminance; TONE_POWER gets no bias and a gain
+// that takes that luminance to 255.
+//
+void autoExposure(const toneStats& stats, int op, float gamma, float& gain, float& bias);
+
+//
+// Tone Maps the HDR data by applying gamma correction
+// \param in data to gamma correct
+// \param out corrected data, resized to match in (may be in); clamped to
+//        [0, 255] but not rounded, for outputs deeper than 8 bits
+// \param gamma value to correct by
+// \param op tone operator (TONE_POWER and the rest)
+//
+void toneMap(const planarImage& in, planarImage& out, float gamma, float gain, float bias, int op = TONE_POWER);
+
+//
+// Tone maps a planar image straight into the interleaved 8 bit RGB24 layout
+// SDL and ppm use, clamping and rounding as part of the pack. Runs the widest
+// SIMD path the CPU supports.
+//
+// Neither tone mapper evaluates the curve per pixel. The scale factor
+// curve(L) / L is tabulated once per gamma/gain/bias change and each pixel
+// costs a lookup and three multiplies. When in.returnEightBit() is set the
+// table has an entry for every possible luminance, so the output is exactly
+// what evaluating the curve would give. Otherwise the scale is interpolated
+// from a table of 128 segments per octave, and kept within a relative 2e-5
+// of the curve (segments that can't manage that are evaluated directly), so
+// results can differ by at most one step of the 8 bit output, and only where
+// a value sits on a rounding boundary. Pixels with zero or negative
+// luminance come out black. The global operators all go through these
+// tables; TONE_LOCAL depends on more than a pixel's luminance, so its scale
+// is evaluated per pixel against an adaptation image about TONE_LOCAL_SIDE
+// pixels across, blurred with convolution()'s gaussian.
+//
+// \param in planar RGB input
+// \param out interleaved RGB24 output, 3 * width * height bytes
+// \param gamma value to correct by
+// \param gain multiplier applied to luminance before the curve
+// \param bias offset applied to luminance before the curve
+// \param op tone operator (TONE_POWER and the rest)
+//
+void toneMapRGB24(const planarImage& in, unsigned char* out, float gamma, float gain, float bias, int op = TONE_POWER);
+
+//tables of one tone curve, shared between every caller using the same settings
+struct toneCurve;
+
+//the curve for op, gamma, gain and bias, built or taken from a small cache under a lock; callers working a row at a time look it up once
+std::shared_ptr<const toneCurve> toneCurveFor(int op, float gamma, float gain, float bias);
+
+//same as toneMapRGB24 for count pixels of one row given as three channel spans (always float input), on the calling thread; op can't be TONE_LOCAL
+void toneMapRowRGB24(const toneCurve& curve, const float* red, const float* green, const float* blue, unsigned char* out, int count);
+
+//returns the path toneMapRGB24 uses on this machine
+int toneMapPath();
+
+//limits toneMapRGB24 to at most the given path (used to validate the SIMD code)
+void setToneMapPath(int path);
+
+#endif